@@ -6,6 +6,7 @@
  */
 
 #include <Borders.h>
+#include <Instrumentation.h>
 
 #include <algorithm>
 #include <fstream>
@@ -64,6 +65,7 @@ void Borders::organizeBorders(vector<Halfedge_handle> all_border_halfedge_handle
     }
     borders_.push_back(current_border);
     current_border.edges.clear();
+    Instrumentation::get().count("border_loops");
   }
 }
 
@@ -87,6 +89,7 @@ Borders::border Borders::buildBorder(Halfedge_handle halfedge)
     border.edges.push_back(halfedge);
     halfedge = halfedge->next();
   }
+  return border;
 }
 
 void Borders::sortBorders()
@@ -208,9 +211,11 @@ vector<int> Borders::deleteFacesBelowY(Borders::border& border, Polyhedron& mesh
     {
       if (halfedge->is_border()) continue;
       mesh.erase_facet(halfedge);
+      Instrumentation::get().count("faces_deleted");
     }
     // std::cout << "num of faces deleted: " << to_delete.size() << endl;
     border = buildBorder(passing_halfedge);
+    Instrumentation::get().count("trim_passes");
     to_delete.clear();
 
     // // Write off file for debugging
@@ -0,0 +1,375 @@
+/*
+ * CleanInterreflections.cpp
+ *
+ * The interreflection cleaner as a library.
+ */
+
+#include <CleanInterreflections.h>
+#include <Instrumentation.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include <CGAL/IO/Polyhedron_iostream.h>
+#include <CGAL/Polyhedron_incremental_builder_3.h>
+
+typedef Polyhedron::HalfedgeDS HalfedgeDS;
+
+static float YSlope(Halfedge_handle halfedge)
+{
+  auto next_halfedge = halfedge;
+  for (int i = 0; i < 3; i++)
+  {
+    next_halfedge = next_halfedge->next();
+  }
+  return (halfedge->vertex()->point().y() - next_halfedge->vertex()->point().y())/0.001;
+}
+
+// Builds a polyhedron from arrays of vertices and triangles, numbering
+// the facets in order
+class BuildFromArrays : public CGAL::Modifier_base<HalfedgeDS> {
+public:
+  BuildFromArrays(const float* vertices, int nverts, const int* faces, int nfaces) :
+    vertices_(vertices), nverts_(nverts), faces_(faces), nfaces_(nfaces), ok_(false) {}
+
+  void operator()(HalfedgeDS& hds)
+  {
+    typedef HalfedgeDS::Vertex::Point Point;
+    CGAL::Polyhedron_incremental_builder_3<HalfedgeDS> builder(hds, false);
+    builder.begin_surface(nverts_, nfaces_);
+    for (int i = 0; i < nverts_; i++)
+    {
+      builder.add_vertex(Point(vertices_[3*i], vertices_[3*i+1], vertices_[3*i+2]));
+    }
+    for (int i = 0; i < nfaces_ && !builder.error(); i++)
+    {
+      builder.begin_facet();
+      for (int j = 0; j < 3; j++)
+      {
+        builder.add_vertex_to_facet(faces_[3*i+j]);
+      }
+      auto halfedge = builder.end_facet();
+      if (!builder.error())
+      {
+        halfedge->facet()->id() = i;
+      }
+    }
+    if (builder.error())
+    {
+      builder.rollback();
+      return;
+    }
+    builder.end_surface();
+    ok_ = true;
+  }
+
+  bool ok() const { return ok_; }
+
+private:
+  const float* vertices_;
+  int nverts_;
+  const int* faces_;
+  int nfaces_;
+  bool ok_;
+};
+
+// Walk from the start of an arm border towards the body, and return the
+// halfedge where the y-slope changes the most.  Only goes part of the
+// way around.
+static Halfedge_handle findCutoff(Borders::border& arm_border, Halfedge_handle start)
+{
+  vector<float> slopes_differences;
+  auto current_halfedge = start->next();
+  for (int i = 0; i < arm_border.edges.size() * 0.3; i++)
+  {
+    auto current_slope = YSlope(current_halfedge);
+    current_halfedge = current_halfedge->next();
+    auto three_forward = current_halfedge->next()->next();
+    auto next_slope = YSlope(three_forward);
+    float slope_diff = next_slope - current_slope;
+    slopes_differences.push_back(slope_diff);
+  }
+
+  // Chose y-value at maximum slope diff
+  auto max_slope = max_element(slopes_differences.begin(), slopes_differences.end());
+  auto vertex_from_start = distance(slopes_differences.begin(), max_slope);
+
+  Halfedge_handle cutoff_halfedge = start;
+  for (int i = 0; i < vertex_from_start; i++)
+  {
+    cutoff_halfedge = cutoff_halfedge->next();
+  }
+  return cutoff_halfedge;
+}
+
+CleanInterreflectionsResult cleanInterreflections(Polyhedron& mesh)
+{
+  Instrumentation& instrumentation = Instrumentation::get();
+  CleanInterreflectionsResult result;
+
+  // Find, organize and calculate border centroids
+  Instrumentation::ScopedTimer borders_timer("borders");
+  Borders borders(mesh);
+  borders.calcBorderCentroids();
+  borders.sortBorders();
+  reverse(borders.borders_.begin(), borders.borders_.end());
+  borders_timer.stop();
+
+  Instrumentation::ScopedTimer smooth_timer("smooth_borders");
+  borders.smoothBorders(10); // Smooth out jumps
+  smooth_timer.stop();
+
+  if (borders.borders_.size() < 4)
+  {
+    result.error = "expected at least 4 borders";
+    return result;
+  }
+
+  // Find arm borders
+  Instrumentation::ScopedTimer cutoff_timer("find_cutoffs");
+  // Assumed border furthest left = right arm and border furthest right = left arm
+  Borders::border left_arm_border, right_arm_border;
+  right_arm_border.centroid = Point_3(0,0,0);
+  left_arm_border.centroid = Point_3(0,0,0);
+
+  // Only consider x largest borders
+  for (int i = 0; i < 4; i++)
+  {
+    auto border = borders.borders_[i];
+
+    if (border.centroid.x() > left_arm_border.centroid.x())
+    {
+      left_arm_border = border;
+    }
+
+    if (border.centroid.x() < right_arm_border.centroid.x())
+    {
+      right_arm_border = border;
+    }
+  }
+  if (left_arm_border.edges.empty() || right_arm_border.edges.empty())
+  {
+    result.error = "could not find both arm borders";
+    return result;
+  }
+
+  // Get min Y value for each arm hole by ...
+  // Start with halfedge handle with point with greatest z-value (left arm)
+  // Start with halfedge handle with point with smallest z-value (right arm)
+  // Because CGAL lets you circle borders counter clockwise and we want to travel towards the body
+  auto start_left_border = left_arm_border.edges[0];
+  auto start_right_border = right_arm_border.edges[0];
+
+  for (auto border_half_edge : left_arm_border.edges)
+  {
+    if (border_half_edge->vertex()->point().z() > start_left_border->vertex()->point().z())
+    {
+      start_left_border = border_half_edge;
+    }
+  }
+
+  for (auto border_half_edge : right_arm_border.edges)
+  {
+    if (border_half_edge->vertex()->point().z() < start_right_border->vertex()->point().z())
+    {
+      start_right_border = border_half_edge;
+    }
+  }
+
+  // From starting point, travel towards body, comparing y-slopes along the way
+  auto cutoff_halfedge_left = findCutoff(left_arm_border, start_left_border);
+  auto cutoff_halfedge_right = findCutoff(right_arm_border, start_right_border);
+  result.cutoff_y_left = cutoff_halfedge_left->vertex()->point().y();
+  result.cutoff_y_right = cutoff_halfedge_right->vertex()->point().y();
+  cutoff_timer.stop();
+
+  // Delete faces in arm hole below min Y value
+  Instrumentation::ScopedTimer trim_timer("trim");
+  auto to_delete_left = borders.deleteFacesBelowY(left_arm_border, mesh, result.cutoff_y_left);
+  auto to_delete_right = borders.deleteFacesBelowY(right_arm_border, mesh, result.cutoff_y_right);
+
+  // Combine indices to delete into single vector
+  result.faces_to_delete.reserve(to_delete_left.size() + to_delete_right.size());
+  result.faces_to_delete.insert(result.faces_to_delete.end(), to_delete_left.begin(), to_delete_left.end());
+  result.faces_to_delete.insert(result.faces_to_delete.end(), to_delete_right.begin(), to_delete_right.end());
+  trim_timer.stop();
+
+  instrumentation.set("faces_to_delete", result.faces_to_delete.size());
+  result.ok = true;
+  return result;
+}
+
+CleanInterreflectionsResult cleanInterreflections(const float* vertices, int nverts,
+    const int* faces, int nfaces)
+{
+  for (int i = 0; i < 3 * nfaces; i++)
+  {
+    if (faces[i] < 0 || faces[i] >= nverts)
+    {
+      CleanInterreflectionsResult result;
+      result.error = "face index out of range";
+      return result;
+    }
+  }
+
+  Instrumentation::ScopedTimer build_timer("build_polyhedron");
+  Polyhedron mesh;
+  BuildFromArrays builder(vertices, nverts, faces, nfaces);
+  mesh.delegate(builder);
+  build_timer.stop();
+  if (!builder.ok())
+  {
+    CleanInterreflectionsResult result;
+    result.error = "mesh is not a valid polyhedral surface";
+    return result;
+  }
+  return cleanInterreflections(mesh);
+}
+
+CleanInterreflectionsResult cleanInterreflections(const TriMesh& trimesh)
+{
+  int nf = trimesh.faces.size();
+  vector<int> faces(3 * nf);
+  for (int i = 0; i < nf; i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      faces[3*i+j] = trimesh.faces[i][j];
+    }
+  }
+  const float* vertices = trimesh.vertices.empty() ? NULL : &trimesh.vertices[0][0];
+  return cleanInterreflections(vertices, trimesh.vertices.size(),
+      faces.empty() ? NULL : &faces[0], nf);
+}
+
+CleanInterreflectionsResult cleanInterreflections(SharedMesh& shared)
+{
+  Instrumentation& instrumentation = Instrumentation::get();
+  SharedMeshHeader& header = shared.header();
+  instrumentation.set("shm_faces", shared.nfaces());
+  instrumentation.set("shm_vertices", shared.nverts());
+
+  CleanInterreflectionsResult result = cleanInterreflections(shared.vertices(),
+      shared.nverts(), shared.faces(), shared.nfaces());
+
+  Instrumentation::ScopedTimer bitmap_timer("write_bitmap");
+  shared.setDeleted(result.faces_to_delete);
+  header.cutoff_y_left = result.cutoff_y_left;
+  header.cutoff_y_right = result.cutoff_y_right;
+  header.faces_deleted = 0;
+  for (int i = 0; i < shared.nfaces(); i++)
+  {
+    header.faces_deleted += shared.isDeleted(i);
+  }
+  header.status = result.ok ? SHARED_MESH_CLEANED : SHARED_MESH_FAILED;
+  bitmap_timer.stop();
+  return result;
+}
+
+CleanInterreflectionsResult cleanInterreflectionsShared(const char* name)
+{
+  std::string error;
+  SharedMesh* shared = SharedMesh::open(name, error);
+  if (!shared)
+  {
+    CleanInterreflectionsResult result;
+    result.error = error;
+    return result;
+  }
+  CleanInterreflectionsResult result = cleanInterreflections(*shared);
+  delete shared;
+  return result;
+}
+
+void deleteFaces(TriMesh* trimesh, const CleanInterreflectionsResult& result)
+{
+  int nf = trimesh->faces.size();
+  vector<bool> to_delete(nf, false);
+  for (auto i : result.faces_to_delete)
+  {
+    if (i >= 0 && i < nf)
+    {
+      to_delete[i] = true;
+    }
+  }
+  int nkept = 0;
+  for (int i = 0; i < nf; i++)
+  {
+    if (!to_delete[i])
+    {
+      trimesh->faces[nkept++] = trimesh->faces[i];
+    }
+  }
+  trimesh->faces.erase(trimesh->faces.begin() + nkept, trimesh->faces.end());
+  trimesh->faces_changed();
+}
+
+CleanInterreflectionsResult cleanInterreflectionsFiles(const char* filenameInOff,
+    const char* filenameInObj, const char* filenameOutObj)
+{
+  Instrumentation& instrumentation = Instrumentation::get();
+  CleanInterreflectionsResult result;
+
+  // Load off file
+  Instrumentation::ScopedTimer read_off_timer("read_off");
+  std::ifstream stream(filenameInOff);
+  if (!stream)
+  {
+    result.error = string("cannot open ") + filenameInOff;
+    return result;
+  }
+
+  Polyhedron mesh;
+  stream >> mesh;
+
+  // Initialize face ids
+  int i(0);
+  for(Polyhedron::Facet_iterator it = mesh.facets_begin(); it != mesh.facets_end(); ++it)
+  {
+    it->id() = i++;
+  }
+  instrumentation.set("off_faces", mesh.size_of_facets());
+  instrumentation.set("off_vertices", mesh.size_of_vertices());
+  read_off_timer.stop();
+
+  // Find the armholes and the faces below their cutoffs
+  result = cleanInterreflections(mesh);
+  if (!result.ok)
+  {
+    return result;
+  }
+
+  // Load obj into TriMesh, delete faces and save out
+  Instrumentation::ScopedTimer read_obj_timer("read_obj");
+  TriMesh* trimesh = TriMesh::read(filenameInObj);
+  if (!trimesh)
+  {
+    result.ok = false;
+    result.error = string("cannot read ") + filenameInObj;
+    return result;
+  }
+  trimesh->need_faces();
+  trimesh->need_face_indices();
+  instrumentation.set("obj_faces", trimesh->faces.size());
+  instrumentation.set("obj_vertices", trimesh->vertices.size());
+  instrumentation.set("obj_degenerate_faces", trimesh->validation.degenerate);
+  instrumentation.set("obj_out_of_range_faces", trimesh->validation.out_of_range);
+  if (trimesh->validation.topology_checked)
+  {
+    instrumentation.set("obj_duplicate_faces", trimesh->validation.duplicate);
+    instrumentation.set("obj_nonmanifold_edges", trimesh->validation.nonmanifold_edges);
+  }
+  read_obj_timer.stop();
+
+  Instrumentation::ScopedTimer compact_timer("compact");
+  deleteFaces(trimesh, result);
+  instrumentation.set("out_faces", trimesh->faces.size());
+  compact_timer.stop();
+
+  Instrumentation::ScopedTimer write_timer("write_obj");
+  trimesh->write(filenameOutObj);
+  write_timer.stop();
+
+  delete trimesh;
+  return result;
+}
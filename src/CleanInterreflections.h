@@ -0,0 +1,61 @@
+/*
+ * CleanInterreflections.h
+ *
+ * The interreflection cleaner as a library: finds the armholes of a
+ * garment and the faces below their cutoffs, which are to be deleted.
+ * Works on a CGAL Polyhedron, or straight from a TriMesh, from arrays
+ * of vertices and faces or from a mesh in shared memory, so meshes can
+ * stay in memory between stages.
+ */
+
+#ifndef CLEAN_INTERREFLECTIONS_
+#define CLEAN_INTERREFLECTIONS_
+
+#include <string>
+#include <vector>
+
+#include "Trimesh2/TriMesh.h"
+
+#include <Borders.h>
+#include <SharedMesh.h>
+
+struct CleanInterreflectionsResult {
+  bool ok;
+  std::string error;
+  float cutoff_y_left;
+  float cutoff_y_right;
+  // Indices of the faces to delete, in the mesh's face order.  There
+  // may be repeats.
+  std::vector<int> faces_to_delete;
+
+  CleanInterreflectionsResult() : ok(false), cutoff_y_left(0), cutoff_y_right(0) {}
+};
+
+// Facet ids must be set to the face indices, as after reading an OFF
+// file.  Trims the armholes of the polyhedron in place.
+CleanInterreflectionsResult cleanInterreflections(Polyhedron& mesh);
+
+// Builds the polyhedron from the mesh; the mesh is not changed
+CleanInterreflectionsResult cleanInterreflections(const TriMesh& trimesh);
+
+// The same, from 3 floats per vertex and 3 indices per face
+CleanInterreflectionsResult cleanInterreflections(const float* vertices, int nverts,
+    const int* faces, int nfaces);
+
+// Reads the arrays in the segment in place, and writes the deletion
+// bitmap and the results into its header
+CleanInterreflectionsResult cleanInterreflections(SharedMesh& shared);
+
+// The same, mapping the segment by name
+CleanInterreflectionsResult cleanInterreflectionsShared(const char* name);
+
+// Remove the faces the cleaner found from the mesh, keeping the others
+// in order
+void deleteFaces(TriMesh* trimesh, const CleanInterreflectionsResult& result);
+
+// The whole pipeline on files, as the executable runs it: read the OFF
+// into a polyhedron, clean it, and write the OBJ without the deleted faces
+CleanInterreflectionsResult cleanInterreflectionsFiles(const char* filenameInOff,
+    const char* filenameInObj, const char* filenameOutObj);
+
+#endif /* CLEAN_INTERREFLECTIONS_ */
@@ -0,0 +1,212 @@
+/*
+ * Instrumentation.cpp
+ *
+ * Per-stage timers, counters and peak memory for one run of the
+ * pipeline, written out as a JSON or CSV report.
+ */
+
+#include <Instrumentation.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "Trimesh2/KDtree.h"
+
+Instrumentation& Instrumentation::get()
+{
+  static thread_local Instrumentation instrumentation;
+  return instrumentation;
+}
+
+Instrumentation::Instrumentation() : depth_(0)
+{
+  kdtree_nodes_start_ = KDtree::nodes_visited.load(std::memory_order_relaxed);
+}
+
+void Instrumentation::reset()
+{
+  garment_.clear();
+  stages_.clear();
+  counters_.clear();
+  depth_ = 0;
+  kdtree_nodes_start_ = KDtree::nodes_visited.load(std::memory_order_relaxed);
+}
+
+// Also counts the queries of any jobs running alongside this one
+unsigned long long Instrumentation::kdtreeNodesVisited() const
+{
+  return KDtree::nodes_visited.load(std::memory_order_relaxed) - kdtree_nodes_start_;
+}
+
+// Stages are listed in the order they start, so nested ones follow
+// the stage they are part of
+Instrumentation::ScopedTimer::ScopedTimer(const char* name)
+{
+  Instrumentation& inst = Instrumentation::get();
+  Instrumentation::stage s;
+  s.name = name;
+  s.depth = inst.depth_++;
+  s.seconds = 0;
+  s.peak_rss_kb = 0;
+  index_ = inst.stages_.size();
+  inst.stages_.push_back(s);
+  running_ = true;
+  start_ = now();
+}
+
+Instrumentation::ScopedTimer::~ScopedTimer()
+{
+  stop();
+}
+
+void Instrumentation::ScopedTimer::stop()
+{
+  if (!running_)
+  {
+    return;
+  }
+  Instrumentation& inst = Instrumentation::get();
+  inst.stages_[index_].seconds = now() - start_;
+  inst.stages_[index_].peak_rss_kb = peakRSSKb();
+  inst.depth_--;
+  running_ = false;
+}
+
+Instrumentation::counter& Instrumentation::find(const char* name)
+{
+  for (auto& c : counters_)
+  {
+    if (c.name == name)
+    {
+      return c;
+    }
+  }
+  counter c;
+  c.name = name;
+  c.value = 0;
+  counters_.push_back(c);
+  return counters_.back();
+}
+
+void Instrumentation::count(const char* name, long long n)
+{
+  find(name).value += n;
+}
+
+void Instrumentation::set(const char* name, long long value)
+{
+  find(name).value = value;
+}
+
+long long Instrumentation::value(const char* name) const
+{
+  for (auto& c : counters_)
+  {
+    if (c.name == name)
+    {
+      return c.value;
+    }
+  }
+  return 0;
+}
+
+// Peak resident set size of the process so far, in KB
+long Instrumentation::peakRSSKb()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+  {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+bool Instrumentation::writeReport(const char* filename) const
+{
+  const char* dot = strrchr(filename, '.');
+  if (dot && strcmp(dot, ".csv") == 0)
+  {
+    return writeCSV(filename);
+  }
+  return writeJSON(filename);
+}
+
+// Quote a string for JSON, or for CSV if csv is set
+static std::string quoted(const std::string& s, bool csv = false)
+{
+  std::string q("\"");
+  for (auto c : s)
+  {
+    if (c == '"')
+    {
+      q += csv ? '"' : '\\';
+    } else if (c == '\\' && !csv)
+    {
+      q += '\\';
+    }
+    q += c;
+  }
+  return q + "\"";
+}
+
+bool Instrumentation::writeJSON(const char* filename) const
+{
+  FILE* f = fopen(filename, "w");
+  if (!f)
+  {
+    perror(filename);
+    return false;
+  }
+  fprintf(f, "{\n  \"garment\": %s,\n", quoted(garment_).c_str());
+  fprintf(f, "  \"peak_rss_kb\": %ld,\n", peakRSSKb());
+  fprintf(f, "  \"stages\": [");
+  for (size_t i = 0; i < stages_.size(); i++)
+  {
+    const stage& s = stages_[i];
+    fprintf(f, "%s\n    { \"name\": %s, \"depth\": %d, \"seconds\": %.6f, "
+        "\"peak_rss_kb\": %ld }", i ? "," : "", quoted(s.name).c_str(),
+        s.depth, s.seconds, s.peak_rss_kb);
+  }
+  fprintf(f, "\n  ],\n  \"counters\": {");
+  for (size_t i = 0; i < counters_.size(); i++)
+  {
+    fprintf(f, "%s\n    %s: %lld", i ? "," : "",
+        quoted(counters_[i].name).c_str(), counters_[i].value);
+  }
+  fprintf(f, "%s\n    \"kdtree_nodes_visited\": %llu\n  }\n}\n",
+      counters_.empty() ? "" : ",", kdtreeNodesVisited());
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+// One row per stage or counter, tagged with the garment, so reports
+// from many runs are easy to combine
+bool Instrumentation::writeCSV(const char* filename) const
+{
+  FILE* f = fopen(filename, "w");
+  if (!f)
+  {
+    perror(filename);
+    return false;
+  }
+  std::string g = quoted(garment_, true);
+  fprintf(f, "garment,kind,name,depth,value,peak_rss_kb\n");
+  for (auto& s : stages_)
+  {
+    fprintf(f, "%s,stage,%s,%d,%.6f,%ld\n", g.c_str(),
+        quoted(s.name, true).c_str(), s.depth, s.seconds, s.peak_rss_kb);
+  }
+  for (auto& c : counters_)
+  {
+    fprintf(f, "%s,counter,%s,,%lld,\n", g.c_str(),
+        quoted(c.name, true).c_str(), c.value);
+  }
+  fprintf(f, "%s,counter,\"kdtree_nodes_visited\",,%llu,\n", g.c_str(),
+      kdtreeNodesVisited());
+  fprintf(f, "%s,total,\"peak_rss_kb\",,%ld,\n", g.c_str(), peakRSSKb());
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
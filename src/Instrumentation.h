@@ -0,0 +1,75 @@
+/*
+ * Instrumentation.h
+ *
+ * Per-stage timers, counters and peak memory for one run of the
+ * pipeline, written out as a JSON or CSV report.  Each thread has its
+ * own, so jobs running side by side don't mix their numbers.
+ */
+
+#ifndef INSTRUMENTATION_
+#define INSTRUMENTATION_
+
+#include <string>
+#include <vector>
+
+#include "Trimesh2/timestamp.h"
+
+class Instrumentation {
+public:
+
+  struct stage{
+    std::string name;
+    int depth;         // How many stages it was nested in
+    double seconds;
+    long peak_rss_kb;  // Peak resident set size when the stage ended
+  };
+
+  struct counter{
+    std::string name;
+    long long value;
+  };
+
+  // Times a stage from construction to destruction, or to stop()
+  class ScopedTimer {
+  public:
+    ScopedTimer(const char* name);
+    ~ScopedTimer();
+    void stop();
+  private:
+    int index_;
+    bool running_;
+    timestamp start_;
+  };
+
+  std::string garment_;
+  std::vector<stage> stages_;
+  std::vector<counter> counters_;
+
+  // The one used by the pipeline on this thread
+  static Instrumentation& get();
+
+  // Start over, for the next job
+  void reset();
+
+  void count(const char* name, long long n = 1);
+  void set(const char* name, long long value);
+  long long value(const char* name) const;
+
+  static long peakRSSKb();
+
+  // Format follows the extension: .csv for CSV, anything else JSON
+  bool writeReport(const char* filename) const;
+  bool writeJSON(const char* filename) const;
+  bool writeCSV(const char* filename) const;
+
+private:
+  int depth_;
+  // KDtree::nodes_visited when this run started; the counter is shared
+  // by the whole process, so reports give the change since then
+  unsigned long long kdtree_nodes_start_;
+  Instrumentation();
+  unsigned long long kdtreeNodesVisited() const;
+  counter& find(const char* name);
+};
+
+#endif /* INSTRUMENTATION_ */
@@ -0,0 +1,444 @@
+/*
+ * Server.cpp
+ *
+ * Daemon mode: a worker pool fed over a Unix domain socket.
+ */
+
+#include <Server.h>
+#include <CleanInterreflections.h>
+#include <Instrumentation.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Jobs whose latency goes into the stats
+#define LATENCY_WINDOW 1024
+
+// Pending connections the kernel holds for us
+#define LISTEN_BACKLOG 64
+
+// Largest allocation glibc will serve from its arenas rather than a fresh
+// mmap (this is the most it allows)
+#define ARENA_MMAP_THRESHOLD (32 * 1024 * 1024)
+
+typedef std::chrono::steady_clock Clock;
+
+struct Job {
+  std::string off, obj, out, report;
+  std::string shm; // Segment name, instead of the files
+  Clock::time_point queued;
+  std::promise<std::string> reply;
+};
+
+// The queue, the workers and the stats, shared by all connections
+class Server {
+public:
+  Server(int nworkers, int nthreads) : nthreads_(nthreads), stopping_(false),
+    active_(0), max_queued_(0), done_(0), failed_(0), nlatencies_(0),
+    latencies_(LATENCY_WINDOW)
+  {
+    for (int i = 0; i < nworkers; i++)
+    {
+      workers_.push_back(std::thread(&Server::work, this));
+    }
+  }
+
+  // Queue a job; the future gets its reply line
+  std::future<std::string> submit(Job* job)
+  {
+    std::future<std::string> reply = job->reply.get_future();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_)
+    {
+      lock.unlock();
+      job->reply.set_value("ERR shutting down");
+      delete job;
+      return reply;
+    }
+    job->queued = Clock::now();
+    queue_.push_back(job);
+    max_queued_ = std::max(max_queued_, queue_.size());
+    lock.unlock();
+    wake_.notify_one();
+    return reply;
+  }
+
+  // Stop taking jobs, finish the queued ones and wait for the workers
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_)
+      {
+        return;
+      }
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  std::string stats()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::ostringstream reply;
+    reply << "OK queued=" << queue_.size() << " active=" << active_ <<
+        " max_queued=" << max_queued_ << " done=" << done_ <<
+        " failed=" << failed_;
+    size_t n = std::min(nlatencies_, latencies_.size());
+    std::vector<double> window(latencies_.begin(), latencies_.begin() + n);
+    lock.unlock();
+
+    if (n == 0)
+    {
+      return reply.str();
+    }
+    sort(window.begin(), window.end());
+    double sum = 0;
+    for (auto t : window)
+    {
+      sum += t;
+    }
+    char buf[160];
+    sprintf(buf, " mean_ms=%.1f p50_ms=%.1f p95_ms=%.1f p99_ms=%.1f max_ms=%.1f",
+        sum / n, percentile(window, 0.5), percentile(window, 0.95),
+        percentile(window, 0.99), window.back());
+    reply << buf;
+    return reply.str();
+  }
+
+private:
+  static double percentile(const std::vector<double>& sorted, double p)
+  {
+    size_t i = std::min(size_t(p * sorted.size()), sorted.size() - 1);
+    return sorted[i];
+  }
+
+  void work()
+  {
+    // Trimesh2 runs its own OpenMP teams; keep workers from
+    // oversubscribing the machine between them
+#ifdef _OPENMP
+    omp_set_num_threads(nthreads_);
+#endif
+    for (;;)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty())
+      {
+        return;
+      }
+      Job* job = queue_.front();
+      queue_.pop_front();
+      active_++;
+      lock.unlock();
+
+      std::string reply = run(job);
+      double ms = std::chrono::duration<double, std::milli>(Clock::now() - job->queued).count();
+
+      lock.lock();
+      active_--;
+      if (reply.compare(0, 2, "OK") == 0)
+      {
+        done_++;
+      }
+      else
+      {
+        failed_++;
+      }
+      latencies_[nlatencies_++ % LATENCY_WINDOW] = ms;
+      lock.unlock();
+
+      job->reply.set_value(reply);
+      delete job;
+    }
+  }
+
+  // Clean one garment on this thread, with its own instrumentation
+  static std::string run(Job* job)
+  {
+    Instrumentation& instrumentation = Instrumentation::get();
+    instrumentation.reset();
+    instrumentation.garment_ = job->shm.empty() ? job->obj : job->shm;
+    Clock::time_point start = Clock::now();
+    Instrumentation::ScopedTimer total_timer("total");
+    CleanInterreflectionsResult result = job->shm.empty() ?
+        cleanInterreflectionsFiles(job->off.c_str(), job->obj.c_str(), job->out.c_str()) :
+        cleanInterreflectionsShared(job->shm.c_str());
+    total_timer.stop();
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    if (!job->report.empty())
+    {
+      instrumentation.writeReport(job->report.c_str());
+    }
+    if (!result.ok)
+    {
+      return "ERR " + result.error;
+    }
+    // The cleaner may list a face more than once
+    std::vector<int>& faces = result.faces_to_delete;
+    sort(faces.begin(), faces.end());
+    int ndeleted = unique(faces.begin(), faces.end()) - faces.begin();
+
+    char buf[128];
+    sprintf(buf, "OK %g %g %d %.1f", result.cutoff_y_left, result.cutoff_y_right,
+        ndeleted, ms);
+    return buf;
+  }
+
+  int nthreads_; // OpenMP threads per worker
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Job*> queue_;
+  std::vector<std::thread> workers_;
+  bool stopping_;
+  int active_;
+  size_t max_queued_;
+  long done_, failed_;
+  size_t nlatencies_;
+  std::vector<double> latencies_; // Ring buffer of the last few
+};
+
+// Reply to one request line
+static std::string handle(Server& server, const std::string& line, int listen_fd)
+{
+  std::istringstream words(line);
+  std::string command;
+  words >> command;
+
+  if (command == "CLEAN")
+  {
+    Job* job = new Job;
+    words >> job->off >> job->obj >> job->out >> job->report;
+    if (job->out.empty())
+    {
+      delete job;
+      return "ERR usage: CLEAN <off> <obj> <out> [report]";
+    }
+    return server.submit(job).get();
+  }
+  if (command == "SHM")
+  {
+    Job* job = new Job;
+    words >> job->shm >> job->report;
+    if (job->shm.empty())
+    {
+      delete job;
+      return "ERR usage: SHM <name> [report]";
+    }
+    return server.submit(job).get();
+  }
+  if (command == "STATS")
+  {
+    return server.stats();
+  }
+  if (command == "SHUTDOWN")
+  {
+    // Wakes up accept() in runServer, which then drains the queue
+    shutdown(listen_fd, SHUT_RDWR);
+    return "OK";
+  }
+  return "ERR unknown command " + command;
+}
+
+static bool writeAll(int fd, const std::string& s)
+{
+  size_t written = 0;
+  while (written < s.size())
+  {
+    ssize_t n = write(fd, s.data() + written, s.size() - written);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+// A client, served on its own thread.  runServer closes the socket once
+// the thread is done.
+struct Connection {
+  int fd;
+  std::atomic<bool> done;
+  std::thread thread;
+
+  Connection(int fd) : fd(fd), done(false) {}
+};
+
+// Read request lines until the client hangs up
+static void serveConnection(Server* server, Connection* connection, int listen_fd)
+{
+  int fd = connection->fd;
+  std::string pending;
+  char buf[4096];
+  for (;;)
+  {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+    pending.append(buf, n);
+
+    size_t start = 0, end;
+    bool ok = true;
+    while (ok && (end = pending.find('\n', start)) != std::string::npos)
+    {
+      std::string line = pending.substr(start, end - start);
+      start = end + 1;
+      if (!line.empty() && line[line.size() - 1] == '\r')
+      {
+        line.erase(line.size() - 1);
+      }
+      if (!line.empty())
+      {
+        ok = writeAll(fd, handle(*server, line, listen_fd) + "\n");
+      }
+    }
+    if (!ok)
+    {
+      break;
+    }
+    pending.erase(0, start);
+  }
+  connection->done = true;
+}
+
+// Join the threads of clients that have hung up, or all of them
+static void reapConnections(std::list<Connection>& connections, bool all)
+{
+  for (auto it = connections.begin(); it != connections.end(); )
+  {
+    if (all || it->done)
+    {
+      it->thread.join();
+      close(it->fd);
+      it = connections.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+// Keep freed memory in the allocator between jobs, so the next garment
+// reuses pages that are already mapped instead of faulting in new ones,
+// and give each worker its own arena
+static void keepAllocatorWarm(int nworkers)
+{
+#ifdef __GLIBC__
+  mallopt(M_MMAP_THRESHOLD, ARENA_MMAP_THRESHOLD);
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_ARENA_MAX, nworkers + 1);
+#endif
+}
+
+int runServer(const char* socket_path, int nworkers, int nthreads)
+{
+  nworkers = std::max(nworkers, 1);
+  if (nthreads <= 0)
+  {
+    nthreads = 1;
+#ifdef _OPENMP
+    nthreads = std::max(1, omp_get_num_procs() / nworkers);
+#endif
+  }
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+  {
+    perror("socket");
+    return 1;
+  }
+  unlink(socket_path);
+  if (bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, LISTEN_BACKLOG) < 0)
+  {
+    perror(socket_path);
+    close(listen_fd);
+    return 1;
+  }
+
+  // Clients that hang up early shouldn't take the server down
+  signal(SIGPIPE, SIG_IGN);
+  keepAllocatorWarm(nworkers);
+
+  Server server(nworkers, nthreads);
+  std::list<Connection> connections;
+  fprintf(stderr, "Listening on %s with %d workers of %d threads\n", socket_path,
+      nworkers, nthreads);
+  for (;;)
+  {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      break; // SHUTDOWN
+    }
+    reapConnections(connections, false);
+    connections.emplace_back(fd);
+    Connection& connection = connections.back();
+    connection.thread = std::thread(serveConnection, &server, &connection, listen_fd);
+  }
+
+  // Finish the queued jobs, so every client waiting on one gets its
+  // reply, then stop reading from the clients and wait for them
+  server.stop();
+  for (auto& connection : connections)
+  {
+    shutdown(connection.fd, SHUT_RD);
+  }
+  reapConnections(connections, true);
+  close(listen_fd);
+  unlink(socket_path);
+  return 0;
+}
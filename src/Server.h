@@ -0,0 +1,38 @@
+/*
+ * Server.h
+ *
+ * Daemon mode: keeps the cleaner running and takes jobs over a Unix
+ * domain socket, so each garment doesn't pay for starting a process.
+ *
+ * The protocol is one line per request, one line per reply:
+ *
+ *   CLEAN <off> <obj> <out> [report]
+ *       -> OK <cutoff_left> <cutoff_right> <faces_deleted> <ms>
+ *   SHM <name> [report]
+ *       -> the same, for a mesh in shared memory (see SharedMesh.h);
+ *          the deletion bitmap is written into the segment
+ *   STATS
+ *       -> OK queued=<n> active=<n> max_queued=<n> done=<n> failed=<n>
+ *             mean_ms=<t> p50_ms=<t> p95_ms=<t> p99_ms=<t> max_ms=<t>
+ *   SHUTDOWN
+ *       -> OK, then finishes the queued jobs and exits
+ *
+ * Any failure replies ERR <message>.  Paths may not contain spaces.
+ * Latencies are from when a job is queued to when it's done, over the
+ * last jobs only.
+ */
+
+#ifndef SERVER_
+#define SERVER_
+
+// Listen on socket_path with nworkers threads cleaning garments.  Each
+// worker runs the OpenMP parts of the pipeline with nthreads threads, so
+// that all of them together don't run more threads than there are
+// cores; if nthreads is 0, the cores are split evenly between the
+// workers.  Few workers with many threads each gives the lowest latency
+// per garment, many workers with few threads the most garments per
+// second.  Returns 0 after SHUTDOWN, or nonzero if the socket can't be
+// set up.
+int runServer(const char* socket_path, int nworkers, int nthreads = 0);
+
+#endif /* SERVER_ */
@@ -0,0 +1,162 @@
+/*
+ * SharedMesh.cpp
+ *
+ * Meshes in POSIX shared memory.
+ */
+
+#include <SharedMesh.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Arrays start on cache-line boundaries
+#define SHARED_MESH_ALIGN 64
+
+static uint64_t align(uint64_t offset)
+{
+  return (offset + SHARED_MESH_ALIGN - 1) & ~uint64_t(SHARED_MESH_ALIGN - 1);
+}
+
+// Fill in the offsets and total size for the counts in the header
+static void layout(SharedMeshHeader& header)
+{
+  uint64_t offset = align(sizeof(SharedMeshHeader));
+  header.vertices_offset = offset;
+  offset = align(offset + 3 * sizeof(float) * header.nverts);
+  header.faces_offset = offset;
+  offset = align(offset + 3 * sizeof(int32_t) * header.nfaces);
+  header.face_uvs_offset = offset;
+  if (header.nuvs)
+  {
+    offset = align(offset + 3 * sizeof(int32_t) * header.nfaces);
+  }
+  header.uvs_offset = offset;
+  offset = align(offset + 2 * sizeof(float) * header.nuvs);
+  header.deleted_offset = offset;
+  header.size = offset + (header.nfaces + 7) / 8;
+}
+
+static std::string describe(const char* what, const char* name)
+{
+  return std::string(what) + " " + name + ": " + strerror(errno);
+}
+
+SharedMesh* SharedMesh::open(const char* name, std::string& error)
+{
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+  {
+    error = describe("cannot open", name);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+  {
+    error = describe("cannot stat", name);
+    close(fd);
+    return NULL;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(SharedMeshHeader))
+  {
+    error = std::string(name) + " is too small for a mesh";
+    close(fd);
+    return NULL;
+  }
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    error = describe("cannot map", name);
+    return NULL;
+  }
+
+  // Only trust the offsets if they're the ones we'd have picked
+  SharedMeshHeader* header = (SharedMeshHeader*) p;
+  SharedMeshHeader expected = *header;
+  layout(expected);
+  if (memcmp(header->magic, SHARED_MESH_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != SHARED_MESH_VERSION)
+  {
+    error = std::string(name) + " is not a shared mesh";
+  }
+  else if (header->nverts > INT32_MAX || header->nfaces > INT32_MAX ||
+      header->nuvs > INT32_MAX || expected.size > size ||
+      memcmp(&expected, header, sizeof(SharedMeshHeader)) != 0)
+  {
+    error = std::string(name) + " has a bad layout";
+  }
+  if (!error.empty())
+  {
+    munmap(p, size);
+    return NULL;
+  }
+  return new SharedMesh(header, size);
+}
+
+SharedMesh* SharedMesh::create(const char* name, int nverts, int nfaces, int nuvs,
+    std::string& error)
+{
+  SharedMeshHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SHARED_MESH_MAGIC, sizeof(header.magic));
+  header.version = SHARED_MESH_VERSION;
+  header.status = SHARED_MESH_PENDING;
+  header.nverts = nverts;
+  header.nfaces = nfaces;
+  header.nuvs = nuvs;
+  layout(header);
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+  {
+    error = describe("cannot create", name);
+    return NULL;
+  }
+  if (ftruncate(fd, header.size) < 0)
+  {
+    error = describe("cannot size", name);
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  void* p = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    error = describe("cannot map", name);
+    shm_unlink(name);
+    return NULL;
+  }
+  // A new segment reads as zeros, so only the header needs writing
+  memcpy(p, &header, sizeof(header));
+  return new SharedMesh((SharedMeshHeader*) p, header.size);
+}
+
+void SharedMesh::unlink(const char* name)
+{
+  shm_unlink(name);
+}
+
+SharedMesh::~SharedMesh()
+{
+  munmap(header_, size_);
+}
+
+void SharedMesh::setDeleted(const std::vector<int>& faces)
+{
+  int nf = nfaces();
+  uint8_t* bits = deleted();
+  memset(bits, 0, (nf + 7) / 8);
+  for (auto i : faces)
+  {
+    if (i >= 0 && i < nf)
+    {
+      bits[i >> 3] |= uint8_t(1 << (i & 7));
+    }
+  }
+}
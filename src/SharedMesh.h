@@ -0,0 +1,90 @@
+/*
+ * SharedMesh.h
+ *
+ * A mesh handed between processes in a POSIX shared-memory segment, so
+ * it never goes through a file.  The producer creates the segment and
+ * fills in flat arrays of vertices, faces and texture coordinates; the
+ * cleaner maps the same segment, reads the arrays in place and writes
+ * back a bitmap of the faces to delete.
+ *
+ * The segment starts with a SharedMeshHeader.  Each array begins at its
+ * offset from the start of the segment, on a 64-byte boundary:
+ *
+ *   vertices   float[3 * nverts]     x, y, z
+ *   faces      int32[3 * nfaces]     vertex indices
+ *   face_uvs   int32[3 * nfaces]     uv indices (absent if nuvs is 0)
+ *   uvs        float[2 * nuvs]       u, v
+ *   deleted    uint8[(nfaces + 7)/8] face i is bit (i % 8) of byte i / 8
+ */
+
+#ifndef SHARED_MESH_
+#define SHARED_MESH_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define SHARED_MESH_MAGIC "CIMESH\0\0"
+#define SHARED_MESH_VERSION 1
+
+// Set in status by the cleaner
+enum {
+  SHARED_MESH_PENDING = 0,
+  SHARED_MESH_CLEANED = 1,
+  SHARED_MESH_FAILED = 2
+};
+
+struct SharedMeshHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t status;
+  uint64_t size;             // Of the whole segment, in bytes
+  uint64_t nverts, nfaces, nuvs;
+  uint64_t vertices_offset, faces_offset, face_uvs_offset, uvs_offset, deleted_offset;
+  // Results
+  float cutoff_y_left, cutoff_y_right;
+  uint64_t faces_deleted;
+};
+
+class SharedMesh {
+public:
+  // Map an existing segment, checking its header.  Returns NULL, with
+  // the reason in error, if it can't.
+  static SharedMesh* open(const char* name, std::string& error);
+
+  // Make a new segment with room for the arrays, and map it.  The
+  // arrays are zeroed.
+  static SharedMesh* create(const char* name, int nverts, int nfaces, int nuvs,
+      std::string& error);
+
+  // Remove the name; the memory goes away once nobody has it mapped
+  static void unlink(const char* name);
+
+  // Unmaps the segment; the contents stay for the other process
+  ~SharedMesh();
+
+  SharedMeshHeader& header() { return *header_; }
+  int nverts() const { return header_->nverts; }
+  int nfaces() const { return header_->nfaces; }
+  int nuvs() const { return header_->nuvs; }
+
+  float* vertices() { return (float*) at(header_->vertices_offset); }
+  int32_t* faces() { return (int32_t*) at(header_->faces_offset); }
+  int32_t* face_uvs() { return nuvs() ? (int32_t*) at(header_->face_uvs_offset) : NULL; }
+  float* uvs() { return nuvs() ? (float*) at(header_->uvs_offset) : NULL; }
+  uint8_t* deleted() { return at(header_->deleted_offset); }
+
+  bool isDeleted(int face) { return (deleted()[face >> 3] >> (face & 7)) & 1; }
+
+  // Clear the bitmap, then mark the faces given
+  void setDeleted(const std::vector<int>& faces);
+
+private:
+  SharedMesh(SharedMeshHeader* header, size_t size) : header_(header), size_(size) {}
+  uint8_t* at(uint64_t offset) { return (uint8_t*) header_ + offset; }
+
+  SharedMeshHeader* header_;
+  size_t size_;
+};
+
+#endif /* SHARED_MESH_ */
@@ -14,6 +14,10 @@ Routines for doing ICP.
 #include "timestamp.h"
 #include "lineqn.h"
 #include <string.h>
+#include <float.h>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 using namespace std;
 
 
@@ -26,6 +30,15 @@ using namespace std;
 #define TERM_THRESH 5
 #define TERM_HIST 7
 #define EIG_THRESH 0.01f
+#define COARSE_MAX_ITERS 30
+#define COARSE_MIN_IMPROVEMENT 0.01f
+#define ACCUM_BLOCK 64
+#define ACCUM_SUMS 6
+#define MEDIAN_SAMPLES 1024
+#define SIGMA2_PER_MEDIAN2 2.198109f
+#define TRIM_SIGMAS 2.5f
+#define HUBER_SIGMAS 1.345f
+#define TUKEY_SIGMAS 4.685f
 
 
 // One or both of the following can be #defined
@@ -33,10 +46,11 @@ using namespace std;
 #undef USE_KD_FOR_OVERLAPS
 
 
-// Quick 'n dirty portable random number generator 
+// Quick 'n dirty portable random number generator.
+// Per-thread state, so that several ICPs can run at once.
 static inline float tinyrnd()
 {
-	static unsigned trand = 0;
+	static thread_local unsigned trand = 0;
 	trand = 1664525u * trand + 1013904223u;
 	return (float) trand / 4294967296.0f;
 }
@@ -52,6 +66,49 @@ struct PtPair {
 };
 
 
+// The same pairs, stored as separate coordinate arrays so that the
+// accumulation of the normal equations can be vectorized
+struct PtPairSoA {
+	vector<float> p1[3], p2[3], n[3];
+	size_t size() const { return p1[0].size(); }
+	void assign(const vector<PtPair> &pairs)
+	{
+		size_t np = pairs.size();
+		for (int j = 0; j < 3; j++) {
+			p1[j].resize(np);
+			p2[j].resize(np);
+			n[j].resize(np);
+			for (size_t i = 0; i < np; i++) {
+				p1[j][i] = pairs[i].p1[j];
+				p2[j][i] = pairs[i].p2[j];
+				n[j][i] = pairs[i].norm[j];
+			}
+		}
+	}
+};
+
+
+// Everything ICP allocates, kept around so that capacity is reused
+// from one iteration, and one call, to the next
+struct ICPWorkspace::Impl {
+	vector<PtPair> pairs;
+	PtPairSoA soa;
+	vector<float> distances2;
+	vector<float> sampcdf1, sampcdf2;
+	vector<float> weights1, weights2;
+
+	// Cached KDtrees.  A tree points into its mesh's vertex array, so
+	// it is stale once that array has moved or changed size.
+	struct CachedTree {
+		const TriMesh *mesh;
+		const point *data;
+		size_t nv;
+		KDtree *kd;
+	};
+	vector<CachedTree> trees;
+};
+
+
 // A class for evaluating compatibility of normals during KDtree searches
 class NormCompat : public KDtree::CompatFunc {
 private:
@@ -76,19 +133,30 @@ public:
 };
 
 
-// Find the median squared distance between points
-static float median_dist2(const vector<PtPair> &pairs)
+// Estimate the median squared distance between points, from at most
+// MEDIAN_SAMPLES evenly-strided pairs (all of them, if there are fewer).
+// If ref is given, also returns the mean of the sampled p2.
+static float median_dist2(const vector<PtPair> &pairs,
+			  vector<float> &distances2, point *ref = NULL)
 {
 	size_t n = pairs.size();
 	if (!n)
 		return 0.0f;
 
-	vector<float> distances2;
-	distances2.reserve(n);
-	for (size_t i = 0; i < n; i++)
+	size_t stride = (n + MEDIAN_SAMPLES - 1) / MEDIAN_SAMPLES;
+	distances2.clear();
+	double sx = 0, sy = 0, sz = 0;
+	for (size_t i = 0; i < n; i += stride) {
 		distances2.push_back(dist2(pairs[i].p1, pairs[i].p2));
+		sx += pairs[i].p2[0];
+		sy += pairs[i].p2[1];
+		sz += pairs[i].p2[2];
+	}
+	size_t ns = distances2.size();
+	if (ref)
+		*ref = point(float(sx / ns), float(sy / ns), float(sz / ns));
 
-	size_t pos = n / 2;
+	size_t pos = ns / 2;
 	nth_element(distances2.begin(),
 		    distances2.begin() + pos,
 		    distances2.end());
@@ -143,14 +211,17 @@ inline Grid::Grid(const vector<point> &pts)
 
 // Determine which points on s1 and s2 overlap the other, filling in o1 and o2
 // Also fills in maxdist, if it is <= 0 on input
-inline void compute_overlaps(TriMesh *s1, TriMesh *s2,
+void compute_overlaps(TriMesh *s1, TriMesh *s2,
 		      const xform &xf1, const xform &xf2,
 		      const KDtree *kd1, const KDtree *kd2,
 		      vector<float> &o1, vector<float> &o2,
 		      float &maxdist, int verbose)
 {
-	s1->need_normals(); s2->need_normals();
 	size_t nv1 = s1->vertices.size(), nv2 = s2->vertices.size();
+	if (s1->normals.size() != nv1)
+		s1->need_normals();
+	if (s2->normals.size() != nv2)
+		s2->need_normals();
 
 	timestamp t = now();
 	Grid g1(s1->vertices);
@@ -259,51 +330,214 @@ static void select_and_match(TriMesh *s1, TriMesh *s2,
 }
 
 
-// Compute ICP alignment matrix, including eigenvector decomposition
-static void compute_ICPmatrix(const vector<PtPair> &pairs,
-			      float evec[6][6], float eval[6], float b[6],
-			      point &centroid, float &scale, float &err)
+// Accumulate the upper triangle of the 7x7 weighted Gram matrix of the
+// rows x = (c, n, d) over all pairs, where c = (p2 - ref) CROSS n and
+// d = (p1 - p2) DOT n.  The 6x6 block is the ICP matrix, the last column
+// is b, and the last entry is the sum of squared errors.  Each pair is
+// weighted according to its point-to-point distance and sigma2, the
+// variance estimated from the median distance.  Also accumulates, into
+// S, the sum of weights, the weighted sum of p2 - ref, the weighted sum
+// of |p2 - ref|^2, and the number of pairs within TRIM_SIGMAS.
+// Pairs are processed in blocks: each block's rows are computed into a
+// small local buffer, then reduced with unit-stride dot products.
+// Threads each reduce a contiguous range of blocks into their own slot,
+// and the slots are summed in thread order so results are repeatable.
+static void accum_ICPmatrix(const PtPairSoA &soa, const point &ref,
+			    int weighting, float sigma2,
+			    double G[7][7], double S[ACCUM_SUMS])
 {
-	size_t n = pairs.size();
+	memset(&G[0][0], 0, 7*7*sizeof(double));
+	memset(S, 0, ACCUM_SUMS*sizeof(double));
+	int n = soa.size();
+	if (n == 0)
+		return;
+	int nblocks = (n + ACCUM_BLOCK - 1) / ACCUM_BLOCK;
+	const float *p1x = &soa.p1[0][0], *p1y = &soa.p1[1][0], *p1z = &soa.p1[2][0];
+	const float *p2x = &soa.p2[0][0], *p2y = &soa.p2[1][0], *p2z = &soa.p2[2][0];
+	const float *nx = &soa.n[0][0], *ny = &soa.n[1][0], *nz = &soa.n[2][0];
+	const float rx = ref[0], ry = ref[1], rz = ref[2];
+
+	// Cutoffs, all as squared distances
+	sigma2 = max(sigma2, FLT_MIN);
+	const float trim2 = sqr(TRIM_SIGMAS) * sigma2;
+	const float huber2 = sqr(HUBER_SIGMAS) * sigma2;
+	const float huber = sqrt(huber2);
+	const float tukey2 = sqr(TUKEY_SIGMAS) * sigma2;
+	const float invtukey2 = 1.0f / tukey2;
+
+	int nthreads = 1;
+#ifdef _OPENMP
+	if (nblocks > 16 && !omp_in_parallel())
+		nthreads = min(omp_get_max_threads(), nblocks / 8);
+#endif
+	const int stride = 7 * 7 + ACCUM_SUMS;
+	vector<double> partial(nthreads * stride);
 
-	centroid = point(0,0,0);
-	for (size_t i = 0; i < n; i++)
-		centroid += pairs[i].p2;
-	centroid /= float(n);
-
-	scale = 0.0f;
-	for (size_t i = 0; i < n; i++)
-		scale += dist2(pairs[i].p2, centroid);
-	scale /= float(n);
-	scale = 1.0f / sqrt(scale);
-
-	memset(&evec[0][0], 0, 6*6*sizeof(float));
-	memset(&b[0], 0, 6*sizeof(float));
-
-	err = 0.0f;
-	for (size_t i = 0; i < n; i++) {
-		const point &p1 = pairs[i].p1;
-		const point &p2 = pairs[i].p2;
-		const vec &n = pairs[i].norm;
-
-		float d = (p1 - p2) DOT n;
-		d *= scale;
-		vec p2c = p2 - centroid;
-		p2c *= scale;
-		vec c = p2c CROSS n;
-
-		err += d * d;
-		float x[6] = { c[0], c[1], c[2], n[0], n[1], n[2] };
-		for (int j = 0; j < 6; j++) {
-			b[j] += d * x[j];
-			for (int k = 0; k < 6; k++)
-				evec[j][k] += x[j] * x[k];
+#pragma omp parallel num_threads(nthreads)
+	{
+		int me = 0;
+#ifdef _OPENMP
+		me = omp_get_thread_num();
+#endif
+		double *Gt = &partial[me * stride], *St = Gt + 7 * 7;
+		float x[7][ACCUM_BLOCK], q[3][ACCUM_BLOCK];
+		float dd[ACCUM_BLOCK], w[ACCUM_BLOCK];
+
+#pragma omp for schedule(static)
+		for (int blk = 0; blk < nblocks; blk++) {
+			int start = blk * ACCUM_BLOCK;
+			int len = min(int(ACCUM_BLOCK), n - start);
+#pragma omp simd
+			for (int i = 0; i < len; i++) {
+				int k = start + i;
+				dd[i] = sqr(p1x[k] - p2x[k]) +
+					sqr(p1y[k] - p2y[k]) +
+					sqr(p1z[k] - p2z[k]);
+			}
+
+			// Weights
+			switch (weighting) {
+			case ICPWorkspace::WEIGHT_HUBER:
+#pragma omp simd
+				for (int i = 0; i < len; i++)
+					w[i] = (dd[i] <= huber2) ? 1.0f :
+						huber / sqrt(dd[i]);
+				break;
+			case ICPWorkspace::WEIGHT_TUKEY:
+#pragma omp simd
+				for (int i = 0; i < len; i++)
+					w[i] = (dd[i] < tukey2) ?
+						sqr(1.0f - dd[i] * invtukey2) :
+						0.0f;
+				break;
+			default:
+#pragma omp simd
+				for (int i = 0; i < len; i++)
+					w[i] = (dd[i] <= trim2) ? 1.0f : 0.0f;
+			}
+
+#pragma omp simd
+			for (int i = 0; i < len; i++) {
+				int k = start + i;
+				float sw = sqrt(w[i]);
+				float px = p2x[k] - rx;
+				float py = p2y[k] - ry;
+				float pz = p2z[k] - rz;
+				q[0][i] = px;
+				q[1][i] = py;
+				q[2][i] = pz;
+				x[0][i] = sw * (py * nz[k] - pz * ny[k]);
+				x[1][i] = sw * (pz * nx[k] - px * nz[k]);
+				x[2][i] = sw * (px * ny[k] - py * nx[k]);
+				x[3][i] = sw * nx[k];
+				x[4][i] = sw * ny[k];
+				x[5][i] = sw * nz[k];
+				x[6][i] = sw * ((p1x[k] - p2x[k]) * nx[k] +
+						(p1y[k] - p2y[k]) * ny[k] +
+						(p1z[k] - p2z[k]) * nz[k]);
+			}
+			for (int j = 0; j < 7; j++) {
+				for (int l = j; l < 7; l++) {
+					float sum = 0.0f;
+#pragma omp simd reduction(+:sum)
+					for (int i = 0; i < len; i++)
+						sum += x[j][i] * x[l][i];
+					Gt[7*j+l] += sum;
+				}
+			}
+
+			float sw = 0.0f, sqx = 0.0f, sqy = 0.0f, sqz = 0.0f;
+			float sqq = 0.0f, sin = 0.0f;
+#pragma omp simd reduction(+:sw,sqx,sqy,sqz,sqq,sin)
+			for (int i = 0; i < len; i++) {
+				sw += w[i];
+				sqx += w[i] * q[0][i];
+				sqy += w[i] * q[1][i];
+				sqz += w[i] * q[2][i];
+				sqq += w[i] * (sqr(q[0][i]) + sqr(q[1][i]) +
+					       sqr(q[2][i]));
+				sin += (dd[i] <= trim2) ? 1.0f : 0.0f;
+			}
+			St[0] += sw;
+			St[1] += sqx;
+			St[2] += sqy;
+			St[3] += sqz;
+			St[4] += sqq;
+			St[5] += sin;
 		}
 	}
 
-	err /= float(n);
+	for (int t = 0; t < nthreads; t++) {
+		for (int j = 0; j < 7; j++)
+			for (int l = j; l < 7; l++)
+				G[j][l] += partial[t*stride + 7*j+l];
+		for (int j = 0; j < ACCUM_SUMS; j++)
+			S[j] += partial[t*stride + 7*7 + j];
+	}
+}
+
+
+// Compute ICP alignment matrix, including eigenvector decomposition.
+// The matrix is accumulated about ref, then moved to be about the
+// weighted centroid of the p2 and scaled by their spread.
+// Returns the number of pairs within TRIM_SIGMAS.
+static size_t compute_ICPmatrix(const vector<PtPair> &pairs, PtPairSoA &soa,
+				const point &ref, int weighting, float sigma2,
+				float evec[6][6], float eval[6], float b[6],
+				point &centroid, float &scale, float &err)
+{
+	soa.assign(pairs);
+
+	double G[7][7], S[ACCUM_SUMS];
+	accum_ICPmatrix(soa, ref, weighting, sigma2, G, S);
+	size_t ninliers = size_t(S[5]);
+	double W = S[0];
+	if (!(W > 0.0))
+		return 0;
+
+	double dx = S[1] / W, dy = S[2] / W, dz = S[3] / W;
+	centroid = ref + point(float(dx), float(dy), float(dz));
+	double var = S[4] / W - (sqr(dx) + sqr(dy) + sqr(dz));
+	double s = 1.0 / sqrt(max(var, 1.0e-30));
+	scale = float(s);
+
+	// x' = M x, where c' = s * (c - (centroid - ref) CROSS n) and d' = s d
+	double M[7][7];
+	memset(&M[0][0], 0, 7*7*sizeof(double));
+	M[0][0] = M[1][1] = M[2][2] = M[6][6] = s;
+	M[3][3] = M[4][4] = M[5][5] = 1.0;
+	M[0][4] =  s * dz;  M[0][5] = -s * dy;
+	M[1][3] = -s * dz;  M[1][5] =  s * dx;
+	M[2][3] =  s * dy;  M[2][4] = -s * dx;
+	for (int j = 0; j < 7; j++)
+		for (int k = 0; k < j; k++)
+			G[j][k] = G[k][j];
+	double MG[7][7];
+	for (int j = 0; j < 7; j++)
+		for (int k = 0; k < 7; k++) {
+			double sum = 0.0;
+			for (int l = 0; l < 7; l++)
+				sum += M[j][l] * G[l][k];
+			MG[j][k] = sum;
+		}
+	for (int j = 0; j < 7; j++)
+		for (int k = j; k < 7; k++) {
+			double sum = 0.0;
+			for (int l = 0; l < 7; l++)
+				sum += MG[j][l] * M[k][l];
+			G[j][k] = sum;
+		}
+
+	for (int j = 0; j < 6; j++) {
+		for (int k = j; k < 6; k++)
+			evec[j][k] = evec[k][j] = float(G[j][k]);
+		b[j] = float(G[j][6]);
+	}
+
+	err = float(G[6][6] / W);
 	err = sqrt(err) / scale;
 	eigdc<float,6>(evec, eval);
+	return ninliers;
 }
 
 
@@ -352,7 +586,7 @@ static void compute_alignxf(float evec[6][6], float eval[6], float b[6],
 
 
 // Compute isotropic or anisotropic scale
-inline void compute_scale(const vector<PtPair> &pairs, xform &alignxf,
+static void compute_scale(const vector<PtPair> &pairs, xform &alignxf,
 		   int verbose, bool do_affine)
 {
 	int n = pairs.size();
@@ -435,7 +669,8 @@ inline void compute_scale(const vector<PtPair> &pairs, xform &alignxf,
 
 
 // Do one iteration of ICP
-static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+static float ICP_iter(ICPWorkspace &ws,
+		      TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		      const KDtree *kd1, const KDtree *kd2,
 		      const vector<float> &weights1, const vector<float> &weights2,
 		      float &maxdist, int verbose,
@@ -447,7 +682,8 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	timestamp t1 = now();
 	if (verbose > 1)
 		fprintf(stderr, "maxdist = %f\n", maxdist);
-	vector<PtPair> pairs;
+	vector<PtPair> &pairs = ws.impl->pairs;
+	pairs.clear();
 	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
 			 maxdist, verbose, pairs, false);
 	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
@@ -459,38 +695,45 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		fprintf(stderr, "Generated %lu pairs in %.2f msec.\n",
 			(unsigned long) np, (t2-t1) * 1000.0f);
 	}
+	if (np < MIN_PAIRS) {
+		if (verbose)
+			fprintf(stderr, "Too few point pairs.\n");
+		return -1.0f;
+	}
 
-	// Reject pairs with distance > 2.5 sigma
-	float thresh = 13.73818f * median_dist2(pairs);
+	// Pairs beyond 2.5 sigma are outliers.  They are rejected (or
+	// down-weighted, depending on ws.weighting) while the matrix is
+	// being accumulated, rather than in a pass of their own.
+	point ref;
+	float sigma2 = SIGMA2_PER_MEDIAN2 *
+		median_dist2(pairs, ws.impl->distances2, &ref);
+	float thresh = sqr(TRIM_SIGMAS) * sigma2;
 	if (verbose > 1)
 		fprintf(stderr, "Rejecting pairs > %f\n", sqrt(thresh));
-	size_t next = 0;
-	for (size_t i = 0; i < np; i++) {
-		if (dist2(pairs[i].p1, pairs[i].p2) <= thresh)
-			pairs[next++] = pairs[i];
-	}
-	pairs.erase(pairs.begin() + next, pairs.end());
+
+	// Do the minimization
+	float evec[6][6], eval[6], b[6], scale, err;
+	point centroid;
+	xform alignxf;
+	size_t ninliers = compute_ICPmatrix(pairs, ws.impl->soa, ref,
+					    ws.weighting, sigma2, evec, eval,
+					    b, centroid, scale, err);
 
 	timestamp t3 = now();
 	if (verbose > 1) {
 		fprintf(stderr, "Rejected %lu pairs in %.2f msec.\n",
-			(unsigned long) (np - pairs.size()), (t3-t2) * 1000.0f);
+			(unsigned long) (np - ninliers), (t3-t2) * 1000.0f);
 	}
-	if (pairs.size() < MIN_PAIRS) {
+	if (ninliers < MIN_PAIRS) {
 		if (verbose)
 			fprintf(stderr, "Too few point pairs.\n");
 		return -1.0f;
 	}
 
 	// Update incr and maxdist based on what happened here
-	incr *= (float) pairs.size() / DESIRED_PAIRS;
+	incr *= (float) ninliers / DESIRED_PAIRS;
 	maxdist = max(2.0f * sqrt(thresh), 0.7f * maxdist);
 
-	// Do the minimization
-	float evec[6][6], eval[6], b[6], scale, err;
-	point centroid;
-	xform alignxf;
-	compute_ICPmatrix(pairs, evec, eval, b, centroid, scale, err);
 	if (verbose > 1) {
 		fprintf(stderr, "RMS point-to-plane error = %f\n", err);
 		for (int i = 0; i < 5; i++)
@@ -501,6 +744,13 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	xf2 = alignxf * xf2;
 
 	if (do_scale || do_affine) {
+		// Scale estimation needs the outliers gone for real
+		size_t next = 0;
+		for (size_t i = 0; i < np; i++) {
+			if (dist2(pairs[i].p1, pairs[i].p2) <= thresh)
+				pairs[next++] = pairs[i];
+		}
+		pairs.erase(pairs.begin() + next, pairs.end());
 		for (size_t i = 0; i < pairs.size(); i++)
 			pairs[i].p2 = alignxf * pairs[i].p2;
 		compute_scale(pairs, alignxf, verbose, do_affine);
@@ -610,7 +860,8 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 
 // Do one iteration of point-to-point ICP (this is done in the early stages
 // to assure stability)
-static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+static float ICP_p2pt(ICPWorkspace::Impl &ws,
+		      TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		      const KDtree *kd1, const KDtree *kd2,
 		      float &maxdist, int verbose,
 		      vector<float> &sampcdf1, vector<float> &sampcdf2,
@@ -620,7 +871,8 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	timestamp t1 = now();
 	if (verbose > 1)
 		fprintf(stderr, "maxdist = %f\n", maxdist);
-	vector<PtPair> pairs;
+	vector<PtPair> &pairs = ws.pairs;
+	pairs.clear();
 	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
 			 maxdist, verbose, pairs, false);
 	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
@@ -634,7 +886,7 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	}
 
 	// Reject pairs with distance > 3 sigma
-	float thresh = 19.782984f * median_dist2(pairs);
+	float thresh = 19.782984f * median_dist2(pairs, ws.distances2);
 	if (verbose > 1)
 		fprintf(stderr, "Rejecting pairs > %f\n", sqrt(thresh));
 	size_t next = 0;
@@ -712,35 +964,43 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 }
 
 
-// Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
-// Returns alignment error, or -1 on failure
-inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
-	  const KDtree *kd1, const KDtree *kd2,
-	  vector<float> &weights1, vector<float> &weights2,
-	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
-	  bool do_scale /* = false */, bool do_affine /* = false */)
+// Make sure we have everything precomputed for ICP on a mesh
+static void ICP_prepare(TriMesh *s)
 {
-	// Make sure we have everything precomputed
-	s1->need_normals();  s2->need_normals();
-	if (!s1->faces.empty() || !s1->tstrips.empty()) {
-		s1->need_neighbors();
-		s1->need_adjacentfaces();
-	}
-	if (!s2->faces.empty() || !s2->tstrips.empty()) {
-		s2->need_neighbors();
-		s2->need_adjacentfaces();
+	if (s->normals.size() != s->vertices.size())
+		s->need_normals();
+	if (!s->faces.empty() || !s->tstrips.empty()) {
+		s->need_neighbors();
+		s->need_adjacentfaces();
 	}
+}
+
+
+// The iterations of ICP on one pair of (already prepared) meshes.
+// Starts from the sampling rate incr and the match distance maxdist,
+// and leaves the adapted values in them for the next level, if any.
+// If early is set, begins with the point-to-point iterations used to
+// get close from a bad starting pose.  The main loop stops after
+// max_iters, or when the error has failed to drop by more than a
+// fraction min_improvement in TERM_THRESH of the last TERM_HIST iterations.
+// If final is set, ends with one iteration at a higher sampling rate.
+static float ICP_align(ICPWorkspace &ws,
+		       TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+		       const KDtree *kd1, const KDtree *kd2,
+		       vector<float> &weights1, vector<float> &weights2,
+		       float &maxdist, float &incr, int verbose,
+		       bool early, int max_iters, float min_improvement,
+		       bool final, bool do_scale, bool do_affine)
+{
 	size_t nv1 = s1->vertices.size(), nv2 = s2->vertices.size();
 
 	timestamp t = now();
 
-	if (maxdist <= 0.0f) {
-		s1->need_bbox();
-		s2->need_bbox();
-		maxdist = 0.5f * min(len(s1->bbox.size()), len(s2->bbox.size()));
-	}
 	// Compute initial CDFs
-	vector<float> sampcdf1(nv1), sampcdf2(nv2);
+	vector<float> &sampcdf1 = ws.impl->sampcdf1;
+	vector<float> &sampcdf2 = ws.impl->sampcdf2;
+	sampcdf1.resize(nv1);
+	sampcdf2.resize(nv2);
 	for (size_t i = 0; i < nv1-1; i++)
 		sampcdf1[i] = (float) (i+1) / nv1;
 	sampcdf1[nv1-1] = 1.0f;
@@ -749,23 +1009,26 @@ inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	sampcdf2[nv2-1] = 1.0f;
 
 	// Do a few p2pt iterations
-	float incr = 4.0f / DESIRED_PAIRS_EARLY;
-	for (int i = 0; i < 2; i++) {
-		if (ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist, verbose,
-			     sampcdf1, sampcdf2, incr, true) < 0.0f)
-			return -1.0f;
-	}
-	for (int i = 0; i < 5; i++) {
-		if (ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist, verbose,
-			     sampcdf1, sampcdf2, incr, false) < 0.0f)
-			return -1.0f;
+	if (early) {
+		for (int i = 0; i < 2; i++) {
+			if (ICP_p2pt(*ws.impl, s1, s2, xf1, xf2, kd1, kd2, maxdist,
+				     verbose, sampcdf1, sampcdf2, incr,
+				     true) < 0.0f)
+				return -1.0f;
+		}
+		for (int i = 0; i < 5; i++) {
+			if (ICP_p2pt(*ws.impl, s1, s2, xf1, xf2, kd1, kd2, maxdist,
+				     verbose, sampcdf1, sampcdf2, incr,
+				     false) < 0.0f)
+				return -1.0f;
+		}
 	}
 
 	// Do a point-to-plane iteration and update CDFs
 	if (weights1.size() != nv1 || weights2.size() != nv2)
 		compute_overlaps(s1, s2, xf1, xf2, kd1, kd2,
 				 weights1, weights2, maxdist, verbose);
-	float err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
+	float err = ICP_iter(ws, s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
 			     maxdist, verbose, sampcdf1, sampcdf2,
 			     incr, true, false, false);
 	if (verbose > 1) {
@@ -788,7 +1051,7 @@ inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		if (recompute)
 			compute_overlaps(s1, s2, xf1, xf2, kd1, kd2,
 					 weights1, weights2, maxdist, verbose);
-		err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
+		err = ICP_iter(ws, s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
 			       maxdist, verbose, sampcdf1, sampcdf2, incr,
 			       recompute, do_scale && !rigid_only,
 			       do_affine && !rigid_only);
@@ -802,11 +1065,13 @@ inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 			return err;
 
 		// Check whether the error's been going up or down lately.
-		// Specifically, we break out if error has gone up in
-		// TERM_THRESH out of the last TERM_HIST iterations.
+		// Specifically, we break out if error has gone up (or down
+		// by less than min_improvement) in TERM_THRESH out of the
+		// last TERM_HIST iterations.
 		for (int i = 0; i < TERM_HIST - 1; i++)
 			err_delta_history[i] = err_delta_history[i+1];
-		err_delta_history[TERM_HIST - 1] = (err >= lasterr);
+		err_delta_history[TERM_HIST - 1] =
+			(err >= (1.0f - min_improvement) * lasterr);
 		int nincreases = 0;
 		for (int i = 0; i < TERM_HIST; i++)
 			nincreases += err_delta_history[i];
@@ -817,19 +1082,21 @@ inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 			err_delta_history.resize(TERM_HIST);
 			rigid_only = false;
 		}
-	} while (++iters < MAX_ITERS);
+	} while (++iters < max_iters);
 
 	if (verbose > 1)
 		fprintf(stderr, "Did %d iterations\n\n", iters);
+	if (!final)
+		return err;
 
 	// One final iteration at a higher sampling rate...
 	if (verbose > 1)
 		fprintf(stderr, "Last iteration...\n");
-	incr *= (float) DESIRED_PAIRS / DESIRED_PAIRS_FINAL;
+	float final_incr = incr * (float) DESIRED_PAIRS / DESIRED_PAIRS_FINAL;
 	if (verbose > 1)
-		fprintf(stderr, "Using incr = %f\n", incr);
-	err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
-		       maxdist, verbose, sampcdf1, sampcdf2, incr,
+		fprintf(stderr, "Using incr = %f\n", final_incr);
+	err = ICP_iter(ws, s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
+		       maxdist, verbose, sampcdf1, sampcdf2, final_incr,
 		       false, do_scale, do_affine);
 	if (verbose > 1) {
 		timestamp tnow = now();
@@ -841,19 +1108,243 @@ inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 }
 
 
+ICPWorkspace::ICPWorkspace() : impl(new Impl), weighting(WEIGHT_TRIMMED)
+{
+}
+
+
+ICPWorkspace::~ICPWorkspace()
+{
+	for (size_t i = 0; i < impl->trees.size(); i++)
+		delete impl->trees[i].kd;
+	delete impl;
+}
+
+
+// Free all the cached KDtrees and buffers
+void ICPWorkspace::clear()
+{
+	for (size_t i = 0; i < impl->trees.size(); i++)
+		delete impl->trees[i].kd;
+	delete impl;
+	impl = new Impl;
+}
+
+
+// Return the KDtree for a mesh, building it if there is no cached tree
+// or if the cached one is stale
+const KDtree *ICPWorkspace::kdtree(const TriMesh *mesh)
+{
+	vector<Impl::CachedTree> &trees = impl->trees;
+	const point *data = mesh->vertices.empty() ? 0 : &mesh->vertices[0];
+	size_t nv = mesh->vertices.size();
+	for (size_t i = 0; i < trees.size(); i++) {
+		if (trees[i].mesh != mesh)
+			continue;
+		if (trees[i].data == data && trees[i].nv == nv)
+			return trees[i].kd;
+		delete trees[i].kd;
+		trees[i].kd = new KDtree(mesh->vertices);
+		trees[i].data = data;
+		trees[i].nv = nv;
+		return trees[i].kd;
+	}
+	Impl::CachedTree t = { mesh, data, nv, new KDtree(mesh->vertices) };
+	trees.push_back(t);
+	return t.kd;
+}
+
+
+// Drop the cached KDtree for a mesh.  Needed if its vertices were moved
+// in place, which kdtree() can't detect.
+void ICPWorkspace::forget(const TriMesh *mesh)
+{
+	vector<Impl::CachedTree> &trees = impl->trees;
+	for (size_t i = 0; i < trees.size(); i++) {
+		if (trees[i].mesh != mesh)
+			continue;
+		delete trees[i].kd;
+		trees.erase(trees.begin() + i);
+		return;
+	}
+}
+
+
+// Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
+// Returns alignment error, or -1 on failure
+float ICP(ICPWorkspace &ws, TriMesh *s1, TriMesh *s2,
+	  const xform &xf1, xform &xf2,
+	  const KDtree *kd1, const KDtree *kd2,
+	  vector<float> &weights1, vector<float> &weights2,
+	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
+	  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	// Make sure we have everything precomputed
+	ICP_prepare(s1);
+	ICP_prepare(s2);
+
+	if (maxdist <= 0.0f) {
+		s1->need_bbox();
+		s2->need_bbox();
+		maxdist = 0.5f * min(len(s1->bbox.size()), len(s2->bbox.size()));
+	}
+
+	float incr = 4.0f / DESIRED_PAIRS_EARLY;
+	return ICP_align(ws, s1, s2, xf1, xf2, kd1, kd2,
+			 weights1, weights2, maxdist, incr, verbose,
+			 true, MAX_ITERS, 0.0f, true, do_scale, do_affine);
+}
+
+
+// Same, with a throwaway workspace
+float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+	  const KDtree *kd1, const KDtree *kd2,
+	  vector<float> &weights1, vector<float> &weights2,
+	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
+	  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	ICPWorkspace ws;
+	return ICP(ws, s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
+		   maxdist, verbose, do_scale, do_affine);
+}
+
+
+// Easier-to-use interface to ICP, with KDtrees cached in the workspace
+float ICP(ICPWorkspace &ws, TriMesh *s1, TriMesh *s2,
+	  const xform &xf1, xform &xf2,
+	  int verbose /* = 0 */,
+	  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	const KDtree *kd1 = ws.kdtree(s1);
+	const KDtree *kd2 = ws.kdtree(s2);
+	ws.impl->weights1.clear();
+	ws.impl->weights2.clear();
+	return ICP(ws, s1, s2, xf1, xf2, kd1, kd2,
+		   ws.impl->weights1, ws.impl->weights2,
+		   0.0f, verbose, do_scale, do_affine);
+}
+
+
 // Easier-to-use interface to ICP
-inline float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	  int verbose /* = 0 */,
 	  bool do_scale /* = false */, bool do_affine /* = false */)
 {
-	KDtree *kd1 = new KDtree(s1->vertices);
-	KDtree *kd2 = new KDtree(s2->vertices);
-	vector<float> weights1, weights2;
-	float icperr = ICP(s1, s2, xf1, xf2, kd1, kd2,
-			   weights1, weights2, 0.0f, verbose,
-			   do_scale, do_affine);
-	delete kd2;
-	delete kd1;
-	return icperr;
+	ICPWorkspace ws;
+	return ICP(ws, s1, s2, xf1, xf2, verbose, do_scale, do_affine);
 }
 
+
+// Build the pyramid.  Each coarser level keeps the lowest-numbered
+// non-boundary vertex in every cell of a grid whose spacing starts at
+// twice the feature size and doubles per level, and copies its normal.
+ICPPyramid::ICPPyramid(TriMesh *mesh, int nlevels /* = 3 */,
+		       int min_verts /* = 500 */)
+{
+	ICP_prepare(mesh);
+	bool pointcloud = (mesh->faces.empty() && mesh->tstrips.empty());
+
+	Level base;
+	base.mesh = mesh;
+	base.kd = new KDtree(mesh->vertices);
+	base.owned = false;
+	base.max_iters = MAX_ITERS;
+	base.min_improvement = 0.0f;
+	levels.push_back(base);
+
+	mesh->need_bbox();
+	float cell = 2.0f * (pointcloud ?
+		len(mesh->bbox.size()) / sqrt(float(mesh->vertices.size())) :
+		mesh->feature_size());
+	int nv = mesh->vertices.size();
+	vector< pair<unsigned long long, int> > keys;
+	keys.reserve(nv);
+
+	for (int l = 1; l < nlevels && cell > 0.0f; l++, cell *= 2.0f) {
+		float invcell = 1.0f / cell;
+		keys.clear();
+		for (int i = 0; i < nv; i++) {
+			if (!pointcloud && mesh->is_bdy(i))
+				continue;
+			vec d = invcell * (mesh->vertices[i] - mesh->bbox.min);
+			unsigned long long x = (unsigned long long) d[0];
+			unsigned long long y = (unsigned long long) d[1];
+			unsigned long long z = (unsigned long long) d[2];
+			keys.push_back(make_pair((x << 42) | (y << 21) | z, i));
+		}
+		sort(keys.begin(), keys.end());
+
+		TriMesh *sub = new TriMesh;
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (i && keys[i].first == keys[i-1].first)
+				continue;
+			int v = keys[i].second;
+			sub->vertices.push_back(mesh->vertices[v]);
+			vec n = mesh->normals[v];
+			normalize(n);
+			sub->normals.push_back(n);
+		}
+		if (sub->vertices.size() < (size_t) min_verts) {
+			delete sub;
+			break;
+		}
+
+		Level level;
+		level.mesh = sub;
+		level.kd = new KDtree(sub->vertices);
+		level.owned = true;
+		level.max_iters = COARSE_MAX_ITERS;
+		level.min_improvement = COARSE_MIN_IMPROVEMENT;
+		levels.push_back(level);
+	}
+}
+
+
+// Free the KDtrees and the decimated meshes
+ICPPyramid::~ICPPyramid()
+{
+	for (size_t i = 0; i < levels.size(); i++) {
+		delete levels[i].kd;
+		if (levels[i].owned)
+			delete levels[i].mesh;
+	}
+}
+
+
+// Multiresolution ICP.  Runs ICP_align on each level shared by the two
+// pyramids, coarsest first, carrying the transform, sampling rate and
+// match distance down to the next finer level.  The point-to-point
+// iterations run only on the coarsest level, and scale/affine only
+// on the finest.
+float ICP(ICPPyramid &p1, ICPPyramid &p2, const xform &xf1, xform &xf2,
+	  int verbose /* = 0 */,
+	  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	TriMesh *s1 = p1.levels[0].mesh, *s2 = p2.levels[0].mesh;
+	s1->need_bbox();
+	s2->need_bbox();
+	float maxdist = 0.5f * min(len(s1->bbox.size()), len(s2->bbox.size()));
+	float incr = 4.0f / DESIRED_PAIRS_EARLY;
+
+	ICPWorkspace ws;
+	int nlevels = min(p1.levels.size(), p2.levels.size());
+	float err = -1.0f;
+	for (int l = nlevels - 1; l >= 0; l--) {
+		const ICPPyramid::Level &l1 = p1.levels[l], &l2 = p2.levels[l];
+		if (verbose > 1)
+			fprintf(stderr, "ICP level %d: %lu and %lu points\n", l,
+				(unsigned long) l1.mesh->vertices.size(),
+				(unsigned long) l2.mesh->vertices.size());
+		vector<float> weights1, weights2;
+		bool finest = (l == 0);
+		err = ICP_align(ws, l1.mesh, l2.mesh, xf1, xf2, l1.kd, l2.kd,
+				weights1, weights2, maxdist, incr, verbose,
+				l == nlevels - 1,
+				min(l1.max_iters, l2.max_iters),
+				max(l1.min_improvement, l2.min_improvement),
+				finest, finest && do_scale, finest && do_affine);
+		if (err < 0.0f)
+			return err;
+	}
+	return err;
+}
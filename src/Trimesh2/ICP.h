@@ -21,6 +21,37 @@ extern void compute_overlaps(TriMesh *s1, TriMesh *s2,
 			     vector<float> &o1, vector<float> &o2,
 			     float &maxdist, int verbose);
 
+// Scratch space for ICP: the buffers used by every iteration, plus a cache
+// of KDtrees for the meshes it has seen.  Reusing one across calls avoids
+// reallocating them each time.  Not thread-safe - keep one per thread.
+// Trees are built and freed one at a time, since they share an allocator.
+class ICPWorkspace {
+public:
+	struct Impl;
+	Impl *impl;
+
+	// How pairs are weighted by their distance, relative to a sigma
+	// estimated from the median distance: rejected beyond 2.5 sigma
+	// (the default), or Huber or Tukey biweight with the usual tuning
+	enum weighting_mode { WEIGHT_TRIMMED, WEIGHT_HUBER, WEIGHT_TUKEY };
+	weighting_mode weighting;
+
+	ICPWorkspace();
+	~ICPWorkspace();
+
+	// The cached KDtree for a mesh, (re)built if missing or stale
+	const KDtree *kdtree(const TriMesh *mesh);
+	// Drop a mesh's tree - needed if its vertices moved in place
+	void forget(const TriMesh *mesh);
+	// Free everything
+	void clear();
+
+private:
+	ICPWorkspace(const ICPWorkspace &);
+	ICPWorkspace &operator = (const ICPWorkspace &);
+};
+
+
 // Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
 // Returns alignment error, or -1 on failure.
 // Pass in 0 for maxdist to figure it out...
@@ -37,4 +68,56 @@ extern float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		 int verbose = 0,
 		 bool do_scale = false, bool do_affine = false);
 
+// The same two, using the buffers in a workspace.  The second one also
+// takes its KDtrees from the workspace cache.
+extern float ICP(ICPWorkspace &ws, TriMesh *s1, TriMesh *s2,
+		 const xform &xf1, xform &xf2,
+		 const KDtree *kd1, const KDtree *kd2,
+		 vector<float> &weights1, vector<float> &weights2,
+		 float maxdist = 0.0f, int verbose = 0,
+		 bool do_scale = false, bool do_affine = false);
+extern float ICP(ICPWorkspace &ws, TriMesh *s1, TriMesh *s2,
+		 const xform &xf1, xform &xf2,
+		 int verbose = 0,
+		 bool do_scale = false, bool do_affine = false);
+
+
+// A stack of successively coarser versions of a mesh, for multiresolution
+// ICP.  Level 0 is the mesh itself; each coarser level is a point cloud
+// decimated on a grid twice as coarse as the one before, with its own
+// KDtree and its own iteration budget.  Stops early once a level would
+// have fewer than min_verts points.  Build once per mesh, reuse across
+// any number of alignments.
+class ICPPyramid {
+public:
+	struct Level {
+		TriMesh *mesh;
+		KDtree *kd;
+		bool owned;
+		int max_iters;
+		float min_improvement;
+	};
+	vector<Level> levels;
+
+	ICPPyramid(TriMesh *mesh, int nlevels = 3, int min_verts = 500);
+	~ICPPyramid();
+
+private:
+	ICPPyramid(const ICPPyramid &);
+	ICPPyramid &operator = (const ICPPyramid &);
+};
+
+// Multiresolution ICP: coarse-to-fine over the levels the pyramids share
+extern float ICP(ICPPyramid &p1, ICPPyramid &p2, const xform &xf1, xform &xf2,
+		 int verbose = 0,
+		 bool do_scale = false, bool do_affine = false);
+
+// Simultaneous alignment of many views (in ICP_multiview.cc).  Runs ICP on
+// every pair of views overlapping by at least min_overlap, in parallel,
+// then relaxes the pose graph so the xforms agree.  xfs holds the initial
+// poses and is updated; view 0 stays fixed.  Returns the number of views
+// connected to view 0, or -1 on failure.
+extern int ICP_multiview(const vector<TriMesh *> &meshes, vector<xform> &xfs,
+			 float min_overlap = 0.1f, int verbose = 0);
+
 #endif
@@ -0,0 +1,352 @@
+/*
+ICP_multiview.cc
+Simultaneous alignment of many views: pairwise ICP between every pair of
+overlapping views, followed by a pose-graph relaxation that distributes
+the pairwise errors over all the views.
+*/
+
+#include <cmath>
+#include <algorithm>
+#include <stdio.h>
+#include "ICP.h"
+#include "KDtree.h"
+#include "timestamp.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+using namespace std;
+
+
+#define POSEGRAPH_ITERS 10
+#define POSEGRAPH_TERM 1.0e-8
+#define MIN_PAIR_ERR 1.0e-6f
+
+
+// One edge of the pose graph: after pairwise ICP, view j lands at
+// xfs[i] * rel in world space
+struct ViewPair {
+	int i, j;
+	float overlap;
+	vector<float> w1, w2;
+	xform rel;
+	float err;
+};
+
+
+static bool pair_err_less(const ViewPair &a, const ViewPair &b)
+{
+	return a.err < b.err;
+}
+
+
+// Fraction of the vertices flagged by compute_overlaps
+static float overlap_fraction(const vector<float> &o)
+{
+	if (o.empty())
+		return 0.0f;
+	size_t n = 0;
+	for (size_t i = 0; i < o.size(); i++)
+		if (o[i])
+			n++;
+	return (float) n / o.size();
+}
+
+
+// Twist (rotation vector, then translation) of a near-identity xform,
+// taken about the point c
+static void xf_to_twist(const xform &xf, const point &c, double t[6])
+{
+	double cosang = 0.5 * (xf[0] + xf[5] + xf[10] - 1.0);
+	cosang = min(max(cosang, -1.0), 1.0);
+	double ang = acos(cosang);
+	double r[3] = { xf[6] - xf[9], xf[8] - xf[2], xf[1] - xf[4] };
+	double rlen = sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+	for (int k = 0; k < 3; k++)
+		t[k] = (rlen > 0.0) ? r[k] * (ang / rlen) : 0.0;
+
+	// Where c moves to
+	point xc = xf * c;
+	for (int k = 0; k < 3; k++)
+		t[k+3] = xc[k] - c[k];
+}
+
+
+// Inverse of the above
+static xform twist_to_xf(const double t[6], const point &c)
+{
+	double ang = sqrt(t[0]*t[0] + t[1]*t[1] + t[2]*t[2]);
+	xform r = xform::rot(ang, t[0], t[1], t[2]);
+	return xform::trans(c[0] + t[3], c[1] + t[4], c[2] + t[5]) * r *
+	       xform::trans(-c[0], -c[1], -c[2]);
+}
+
+
+// Solve A x = b for a dense symmetric positive definite A (Cholesky).
+// A is overwritten.  Returns false if A is not positive definite.
+static bool solve_spd(vector<double> &A, int n,
+		      vector<double> *b, int nrhs)
+{
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j <= i; j++) {
+			double sum = A[i*n+j];
+			for (int k = 0; k < j; k++)
+				sum -= A[i*n+k] * A[j*n+k];
+			if (i == j) {
+				if (sum <= 0.0)
+					return false;
+				A[i*n+i] = sqrt(sum);
+			} else {
+				A[i*n+j] = sum / A[j*n+j];
+			}
+		}
+	}
+	for (int r = 0; r < nrhs; r++) {
+		vector<double> &x = b[r];
+		for (int i = 0; i < n; i++) {
+			double sum = x[i];
+			for (int k = 0; k < i; k++)
+				sum -= A[i*n+k] * x[k];
+			x[i] = sum / A[i*n+i];
+		}
+		for (int i = n-1; i >= 0; i--) {
+			double sum = x[i];
+			for (int k = i+1; k < n; k++)
+				sum -= A[k*n+i] * x[k];
+			x[i] = sum / A[i*n+i];
+		}
+	}
+	return true;
+}
+
+
+// Pose-graph relaxation.  Every pair asks for xfs[j] == xfs[i] * rel;
+// linearizing about the current poses, with each pose correction a small
+// twist about the scene center, turns this into one weighted graph
+// Laplacian solve per twist component.  View fixed stays put.
+static void relax_poses(const vector<ViewPair> &pairs, const vector<int> &ids,
+			int fixed, const point &center, vector<xform> &xfs,
+			int verbose)
+{
+	int n = ids.size() - 1;
+	if (n <= 0)
+		return;
+	vector<int> row(xfs.size(), -1);
+	for (int k = 0, r = 0; k < (int) ids.size(); k++)
+		if (ids[k] != fixed)
+			row[ids[k]] = r++;
+
+	for (int iter = 0; iter < POSEGRAPH_ITERS; iter++) {
+		vector<double> L(n*n);
+		vector<double> b[6];
+		for (int k = 0; k < 6; k++)
+			b[k].resize(n);
+
+		for (size_t p = 0; p < pairs.size(); p++) {
+			const ViewPair &vp = pairs[p];
+			int ri = row[vp.i], rj = row[vp.j];
+			if ((ri < 0 && vp.i != fixed) || (rj < 0 && vp.j != fixed))
+				continue;
+			double w = 1.0 / sqr(max(vp.err, MIN_PAIR_ERR));
+
+			// Correction that would move view j onto its
+			// pairwise target: t_j - t_i = d
+			double d[6];
+			xf_to_twist(xfs[vp.i] * vp.rel * inv(xfs[vp.j]),
+				    center, d);
+			if (ri >= 0)
+				L[ri*n+ri] += w;
+			if (rj >= 0)
+				L[rj*n+rj] += w;
+			if (ri >= 0 && rj >= 0) {
+				L[ri*n+rj] -= w;
+				L[rj*n+ri] -= w;
+			}
+			for (int k = 0; k < 6; k++) {
+				if (ri >= 0)
+					b[k][ri] -= w * d[k];
+				if (rj >= 0)
+					b[k][rj] += w * d[k];
+			}
+		}
+		if (!solve_spd(L, n, b, 6)) {
+			if (verbose)
+				fprintf(stderr, "Pose graph is singular!\n");
+			return;
+		}
+
+		double change = 0.0;
+		for (int k = 0; k < (int) ids.size(); k++) {
+			int v = ids[k], r = row[v];
+			if (r < 0)
+				continue;
+			double t[6];
+			for (int c = 0; c < 6; c++) {
+				t[c] = b[c][r];
+				change += sqr(t[c]);
+			}
+			xfs[v] = twist_to_xf(t, center) * xfs[v];
+			orthogonalize(xfs[v]);
+		}
+		if (verbose > 1)
+			fprintf(stderr, "Pose graph iteration %d: change %g\n",
+				iter, sqrt(change));
+		if (change < POSEGRAPH_TERM)
+			break;
+	}
+}
+
+
+// Align all the views to each other.  xfs holds the starting pose of each
+// view (resized to identity if too short), and is updated in place; view 0
+// stays fixed.  Pairs whose overlap is below min_overlap at the starting
+// poses are not aligned.  Returns the number of views that ended up
+// connected to view 0 (including itself), or -1 on failure.
+int ICP_multiview(const vector<TriMesh *> &meshes, vector<xform> &xfs,
+		  float min_overlap /* = 0.1f */, int verbose /* = 0 */)
+{
+	int nviews = meshes.size();
+	if (nviews < 1)
+		return -1;
+	xfs.resize(nviews);
+	if (nviews == 1)
+		return 1;
+
+	timestamp t = now();
+
+	// Everything that mutates the meshes happens here, once, before any
+	// of the parallel work.  The trees are built here too: KDtrees share
+	// an allocator, so they'd only take turns anyway.
+	vector<KDtree *> kds(nviews);
+	double csum[3] = { 0.0, 0.0, 0.0 };
+	size_t ntotal = 0;
+	for (int i = 0; i < nviews; i++) {
+		TriMesh *m = meshes[i];
+		if (m->vertices.empty())
+			return -1;
+		if (m->normals.size() != m->vertices.size())
+			m->need_normals();
+		if (!m->faces.empty() || !m->tstrips.empty()) {
+			m->need_neighbors();
+			m->need_adjacentfaces();
+		}
+		m->need_bbox();
+		kds[i] = new KDtree(m->vertices);
+		for (size_t v = 0; v < m->vertices.size(); v++) {
+			point p = xfs[i] * m->vertices[v];
+			for (int k = 0; k < 3; k++)
+				csum[k] += p[k];
+		}
+		ntotal += m->vertices.size();
+	}
+	point center(csum[0] / ntotal, csum[1] / ntotal, csum[2] / ntotal);
+	if (verbose > 1)
+		fprintf(stderr, "Built %d KDtrees in %.2f msec.\n",
+			nviews, (now() - t) * 1000.0f);
+
+	// Find the overlapping pairs
+	vector<ViewPair> candidates;
+	for (int i = 0; i < nviews; i++) {
+		for (int j = i + 1; j < nviews; j++) {
+			ViewPair vp;
+			vp.i = i;  vp.j = j;
+			vp.overlap = 0.0f;
+			vp.err = -1.0f;
+			candidates.push_back(vp);
+		}
+	}
+	int ncand = candidates.size();
+#pragma omp parallel for schedule(dynamic)
+	for (int p = 0; p < ncand; p++) {
+		ViewPair &vp = candidates[p];
+		float maxdist = 0.0f;
+		compute_overlaps(meshes[vp.i], meshes[vp.j],
+				 xfs[vp.i], xfs[vp.j], kds[vp.i], kds[vp.j],
+				 vp.w1, vp.w2, maxdist, 0);
+		vp.overlap = min(overlap_fraction(vp.w1),
+				 overlap_fraction(vp.w2));
+		if (vp.overlap < min_overlap) {
+			vector<float>().swap(vp.w1);
+			vector<float>().swap(vp.w2);
+		}
+	}
+	vector<ViewPair> pairs;
+	for (int p = 0; p < ncand; p++) {
+		if (candidates[p].overlap >= min_overlap) {
+			pairs.push_back(ViewPair());
+			swap(pairs.back(), candidates[p]);
+		}
+	}
+	candidates.clear();
+	if (verbose)
+		fprintf(stderr, "%lu overlapping pairs of %d views\n",
+			(unsigned long) pairs.size(), nviews);
+
+	// Pairwise ICP, all at once, with a workspace per thread
+	int npairs = pairs.size();
+	int nthreads = 1;
+#ifdef _OPENMP
+	nthreads = omp_get_max_threads();
+#endif
+	vector<ICPWorkspace> workspaces(nthreads);
+#pragma omp parallel for schedule(dynamic)
+	for (int p = 0; p < npairs; p++) {
+		int me = 0;
+#ifdef _OPENMP
+		me = omp_get_thread_num();
+#endif
+		ViewPair &vp = pairs[p];
+		xform xf2 = xfs[vp.j];
+		vp.err = ICP(workspaces[me], meshes[vp.i], meshes[vp.j],
+			     xfs[vp.i], xf2, kds[vp.i], kds[vp.j],
+			     vp.w1, vp.w2, 0.0f, 0);
+		vp.rel = inv(xfs[vp.i]) * xf2;
+		vector<float>().swap(vp.w1);
+		vector<float>().swap(vp.w2);
+	}
+	for (int i = 0; i < nviews; i++)
+		delete kds[i];
+
+	// Drop the failures
+	size_t ngood = 0;
+	for (int p = 0; p < npairs; p++) {
+		if (verbose > 1)
+			fprintf(stderr, "Pair %d-%d: overlap %.3f, err %g\n",
+				pairs[p].i, pairs[p].j,
+				pairs[p].overlap, pairs[p].err);
+		if (pairs[p].err >= 0.0f)
+			pairs[ngood++] = pairs[p];
+	}
+	pairs.resize(ngood);
+	sort(pairs.begin(), pairs.end(), pair_err_less);
+
+	// Only the views reachable from view 0 can be placed relative to it.
+	// Start each from the pose given by the best pair that reaches it.
+	vector<bool> reached(nviews);
+	vector<int> ids(1, 0);
+	reached[0] = true;
+	for (size_t k = 0; k < ids.size(); k++) {
+		for (size_t p = 0; p < pairs.size(); p++) {
+			int other = -1;
+			if (pairs[p].i == ids[k])
+				other = pairs[p].j;
+			else if (pairs[p].j == ids[k])
+				other = pairs[p].i;
+			if (other < 0 || reached[other])
+				continue;
+			reached[other] = true;
+			ids.push_back(other);
+			if (other == pairs[p].j)
+				xfs[other] = xfs[ids[k]] * pairs[p].rel;
+			else
+				xfs[other] = xfs[ids[k]] * inv(pairs[p].rel);
+		}
+	}
+
+	relax_poses(pairs, ids, 0, center, xfs, verbose);
+
+	if (verbose)
+		fprintf(stderr, "Aligned %lu of %d views in %.2f msec.\n",
+			(unsigned long) ids.size(), nviews,
+			(now() - t) * 1000.0f);
+	return ids.size();
+}
@@ -13,6 +13,7 @@ a given point, or to a ray).
 #include "mempool.h"
 #include <vector>
 #include <algorithm>
+#include <mutex>
 using std::vector;
 using std::swap;
 using std::sqrt;
@@ -50,6 +51,7 @@ public:
 		const float *closest;
 		float closest_d, closest_d2;
 		const KDtree::CompatFunc *iscompat;
+		unsigned long long nvisited;
 	};
 
 	enum { MAX_PTS_PER_NODE = 7 };
@@ -82,8 +84,11 @@ public:
 };
 
 
-// Class static variable
+// Class static variables.  The pool isn't thread-safe, so building and
+// deleting trees hold memPoolLock.
 PoolAlloc KDtree::Node::memPool(sizeof(KDtree::Node));
+static std::mutex memPoolLock;
+std::atomic<unsigned long long> KDtree::nodes_visited(0);
 
 
 // Create a KD tree from the points pointed to by the array pts
@@ -166,6 +171,8 @@ KDtree::Node::~Node()
 // Crawl the KD tree
 void KDtree::Node::find_closest_to_pt(KDtree::Node::Traversal_Info &k) const
 {
+	k.nvisited++;
+
 	// Leaf nodes
 	if (npts) {
 		for (int i = 0; i < npts; i++) {
@@ -204,6 +211,8 @@ void KDtree::Node::find_closest_to_pt(KDtree::Node::Traversal_Info &k) const
 // the line going through k.p in the direction k.dir
 void KDtree::Node::find_closest_to_ray(KDtree::Node::Traversal_Info &k) const
 {
+	k.nvisited++;
+
 	// Leaf nodes
 	if (npts) {
 		for (int i = 0; i < npts; i++) {
@@ -241,6 +250,7 @@ void KDtree::build(const float *ptlist, int n)
 	for (int i = 0; i < n; i++)
 		pts[i] = ptlist + i * 3;
 
+	std::lock_guard<std::mutex> lock(memPoolLock);
 	root = new Node(&(pts[0]), n);
 }
 
@@ -248,6 +258,7 @@ void KDtree::build(const float *ptlist, int n)
 // Delete a KDtree
 KDtree::~KDtree()
 {
+	std::lock_guard<std::mutex> lock(memPoolLock);
 	delete root;
 }
 
@@ -261,12 +272,14 @@ const float *KDtree::closest_to_pt(const float *p, float maxdist2,
 	k.p = p;
 	k.iscompat = iscompat;
 	k.closest = NULL;
+	k.nvisited = 0;
 	if (maxdist2 <= 0.0f)
 		maxdist2 = sqr(root->node.r);
 	k.closest_d2 = maxdist2;
 	k.closest_d = sqrt(k.closest_d2);
 
 	root->find_closest_to_pt(k);
+	nodes_visited.fetch_add(k.nvisited, std::memory_order_relaxed);
 
 	return k.closest;
 }
@@ -288,12 +301,14 @@ const float *KDtree::closest_to_ray(const float *p, const float *dir,
 	k.p = p;
 	k.iscompat = iscompat;
 	k.closest = NULL;
+	k.nvisited = 0;
 	if (maxdist2 <= 0.0f)
 		maxdist2 = sqr(root->node.r);
 	k.closest_d2 = maxdist2;
 	k.closest_d = sqrt(k.closest_d2);
 
 	root->find_closest_to_ray(k);
+	nodes_visited.fetch_add(k.nvisited, std::memory_order_relaxed);
 
 	return k.closest;
 }
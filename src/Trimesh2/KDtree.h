@@ -10,6 +10,7 @@ a given point, or to a ray).
 */
 
 #include <vector>
+#include <atomic>
 
 class KDtree {
 private:
@@ -41,6 +42,10 @@ public:
 	const float *closest_to_ray(const float *p, const float *dir,
 				    float maxdist2,
 				    const CompatFunc *iscompat = NULL) const;
+
+	// Total number of nodes visited by all queries on all trees,
+	// for profiling
+	static std::atomic<unsigned long long> nodes_visited;
 };
 
 #endif
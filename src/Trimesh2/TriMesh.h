@@ -45,6 +45,11 @@ public:
 	// Enums
 	enum tstrip_rep { TSTRIP_LENGTH, TSTRIP_TERM };
 	enum { GRID_INVALID = -1 };
+	enum { GEOM_FACES = 1, GEOM_NORMALS = 2, GEOM_POINTAREAS = 4 };
+	enum cache_id { CACHE_FACEGEOM, CACHE_NORMALS, CACHE_POINTAREAS,
+			CACHE_CURVATURES, CACHE_DCURV, CACHE_BBOX,
+			CACHE_BSPHERE, CACHE_NEIGHBORS, CACHE_ADJACENTFACES,
+			CACHE_ACROSS_EDGE, CACHE_FACE_DISTS, NUM_CACHES };
 
 	// The basics: vertices and faces
 	vector<point> vertices;
@@ -97,6 +102,50 @@ public:
 	//  Hence why it's a 1D vector
 	vector<Face> across_edge;
 
+	// Generations of the vertices and faces, and the generations each
+	// computed property was last computed from.  Code that edits vertices
+	// or faces in place calls vertices_changed() or faces_changed(), and
+	// each need_* recomputes only if something it depends on has changed.
+	// Code that overwrites a computed property in place (e.g., with
+	// filtered values) calls cache_invalidate() on it, so the next need_*
+	// computes it afresh.
+	unsigned vert_gen, face_gen;
+	unsigned cache_vgen[NUM_CACHES], cache_fgen[NUM_CACHES];
+
+	struct CacheInfo {
+		const char *name;
+		bool live;
+		size_t bytes;
+	};
+
+	// What validate() found.  Counts are of faces, except for
+	// nonmanifold_edges, and describe the mesh before any repair.
+	// duplicate and nonmanifold_edges are only counted if topology
+	// was checked.
+	enum { REPAIR_OFFSET = 1, REPAIR_OUT_OF_RANGE = 2,
+	       REPAIR_DEGENERATE = 4, REPAIR_DUPLICATE = 8,
+	       REPAIR_ALL = 15 };
+	struct Validation {
+		int min_ind, max_ind;	// Range of indices used by the faces
+		int offset;		// Uniform offset subtracted, if repaired
+		int out_of_range;	// Any index outside 0..nv-1
+		int degenerate;		// A vertex used twice
+		int duplicate;		// Same vertices as an earlier face
+		int nonmanifold_edges;	// Edges of more than 2 good faces
+		int removed;		// Faces removed by the repair
+		bool topology_checked;	// Whether duplicates and edges were
+		Validation() : min_ind(0), max_ind(-1), offset(0),
+			out_of_range(0), degenerate(0), duplicate(0),
+			nonmanifold_edges(0), removed(0),
+			topology_checked(false)
+			{}
+		bool ok() const
+			{ return !out_of_range && !degenerate && !duplicate &&
+				 !nonmanifold_edges; }
+	};
+	// Result of the check done by read()
+	Validation validation;
+
 	// MY PROPERTIES MINE
 	float totalFaceArea;
 	vector< vector<float> > sdfData;
@@ -127,6 +176,18 @@ public:
 	void need_face_indices();
 	void need_normals();
 	void need_pointareas();
+	void need_geometry(int which);
+
+	// Cache bookkeeping
+	void vertices_changed() { vert_gen++; }
+	void faces_changed() { face_gen++; }
+	bool cache_live(cache_id c) const;
+	void cache_stamp(cache_id c)
+		{ cache_vgen[c] = vert_gen; cache_fgen[c] = face_gen; }
+	void cache_invalidate(cache_id c)
+		{ cache_vgen[c] = cache_fgen[c] = 0; }
+	void cache_info(vector<CacheInfo> &info) const;
+	size_t cache_bytes() const;
 	void need_curvatures();
 	void need_dcurv();
 	void need_bbox();
@@ -134,6 +195,12 @@ public:
 	void need_neighbors();
 	void need_adjacentfaces();
 	void need_across_edge();
+	void need_face_dists();
+
+	// Check the faces for bad indices and degenerate faces and, if
+	// topology is set, duplicate faces and non-manifold edges, fixing
+	// whatever the REPAIR_* flags say.  read() does only the cheap part.
+	Validation validate(int repair = 0, bool topology = true);
 
 	// Input and output
 	static TriMesh *read(const char *filename);
@@ -165,8 +232,12 @@ public:
 	static int dprintf(const char *format, ...);
 
 	// Constructor
-	TriMesh() : grid_width(-1), grid_height(-1), flag_curr(0)
-		{}
+	TriMesh() : grid_width(-1), grid_height(-1), flag_curr(0),
+		    vert_gen(1), face_gen(1)
+	{
+		for (int i = 0; i < NUM_CACHES; i++)
+			cache_vgen[i] = cache_fgen[i] = 0;
+	}
 };
 
 
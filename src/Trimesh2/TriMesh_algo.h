@@ -17,6 +17,13 @@ Various mesh-munging algorithms using TriMeshes
 // Optimally re-triangulate a mesh by doing edge flips
 extern void edgeflip(TriMesh *mesh);
 
+// Same, flipping independent sets of edges in parallel
+extern void edgeflip_parallel(TriMesh *mesh);
+
+// Quadric-error edge-collapse simplification down to about target_nfaces,
+// keeping boundaries fixed and carrying texture coordinates along
+extern void decimate(TriMesh *mesh, int target_nfaces);
+
 // Flip the order of vertices in each face.  Turns the mesh inside out.
 extern void faceflip(TriMesh *mesh);
 
@@ -26,6 +33,12 @@ extern void umbrella(TriMesh *mesh, float stepsize);
 // Taubin lambda/mu mesh smoothing
 extern void lmsmooth(TriMesh *mesh, int niters);
 
+// Implicit umbrella-operator smoothing: one backward Euler step of size
+// lambda, solved by preconditioned conjugate gradients.  The bilaplacian
+// version is a low-pass filter that, like lmsmooth, shrinks less.
+extern void lmsmooth_implicit(TriMesh *mesh, float lambda,
+			      bool bilaplacian = true);
+
 // Remove the indicated vertices from the TriMesh.
 extern void remove_vertices(TriMesh *mesh, const std::vector<bool> &toremove);
 
@@ -47,6 +60,10 @@ extern void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table);
 // they are referenced by the tstrips or faces.
 extern void reorder_verts(TriMesh *mesh);
 
+// Reorder faces along a Morton curve through the bounding box, and vertices
+// in the order the faces use them, for better cache locality.
+extern void reorder_spatial(TriMesh *mesh);
+
 // Perform one iteration of subdivision on a mesh.
 enum { SUBDIV_PLANAR, SUBDIV_LOOP, SUBDIV_LOOP_ORIG, SUBDIV_LOOP_NEW,
        SUBDIV_BUTTERFLY, SUBDIV_BUTTERFLY_MODIFIED };
@@ -55,16 +72,45 @@ extern void subdiv(TriMesh *mesh, int scheme = SUBDIV_LOOP);
 // Smooth the mesh geometry
 extern void smooth_mesh(TriMesh *themesh, float sigma);
 
+// Precomputed neighborhoods and weights for Gaussian diffusion of width
+// sigma, as a sparse matrix in compressed-row form.  Row i lists the
+// vertices that diffuse into vertex i, starting with i itself.
+struct DiffusionStencil {
+	float sigma;
+	std::vector<int> start;		// nv+1 row offsets into index, weight
+	std::vector<int> index;
+	std::vector<float> weight;
+	std::vector<float> sum_w;	// Normalization of each row
+};
+
+// Build a diffusion stencil from the current normals and pointareas
+extern void build_diffusion_stencil(TriMesh *themesh, float sigma,
+				    DiffusionStencil &stencil);
+
+// Diffuse a per-vertex vector field using a stencil
+extern void diffuse_vector_field(const TriMesh *themesh,
+				 const DiffusionStencil &stencil,
+				 const std::vector<vec> &field,
+				 std::vector<vec> &out);
+
+// Smooth the mesh geometry with the weights frozen in a stencil
+extern void smooth_mesh(TriMesh *themesh, const DiffusionStencil &stencil);
+
 // Bilateral smoothing
 extern void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2);
 
-// Diffuse the normals across the mesh
+// Bilateral smoothing, finding neighbors in a spatial grid rather than
+// by connectivity
+extern void bilateral_smooth_mesh_grid(TriMesh *themesh, float sigma1, float sigma2);
+
+// Diffuse the normals across the mesh.  The results are left in the
+// mesh, but not cached: the next need_normals() recomputes them.
 extern void diffuse_normals(TriMesh *themesh, float sigma);
 
-// Diffuse the curvatures across the mesh
+// Diffuse the curvatures across the mesh (also not cached)
 extern void diffuse_curv(TriMesh *themesh, float sigma);
 
-// Diffuse the curvature derivatives across the mesh
+// Diffuse the curvature derivatives across the mesh (also not cached)
 extern void diffuse_dcurv(TriMesh *themesh, float sigma);
 
 // Given a curvature tensor, find principal directions and curvatures
@@ -16,7 +16,7 @@ Bounding box and bounding sphere.
 // Find axis-aligned bounding box of the vertices
 void TriMesh::need_bbox()
 {
-	if (vertices.empty() || bbox.valid)
+	if (vertices.empty() || cache_live(CACHE_BBOX))
 		return;
 
 	dprintf("Computing bounding box... ");
@@ -32,6 +32,7 @@ void TriMesh::need_bbox()
 	}
 
 	bbox.valid = true; 
+	cache_stamp(CACHE_BBOX);
 	dprintf("Done.\n  x = %g .. %g, y = %g .. %g, z = %g .. %g\n",
 		bbox.min[0], bbox.max[0], bbox.min[1],
 		bbox.max[1], bbox.min[2], bbox.max[2]);
@@ -45,7 +46,7 @@ void TriMesh::need_bbox()
 // Compute bounding sphere of the vertices.
 void TriMesh::need_bsphere()
 {
-	if (vertices.empty() || bsphere.valid)
+	if (vertices.empty() || cache_live(CACHE_BSPHERE))
 		return;
 
 	dprintf("Computing bounding sphere... ");
@@ -56,6 +57,7 @@ void TriMesh::need_bsphere()
 	bsphere.center = mb.center();
 	bsphere.r = sqrt(mb.squared_radius());
 	bsphere.valid = true; 
+	cache_stamp(CACHE_BSPHERE);
 
 	dprintf("Done.\n  center = (%g, %g, %g), radius = %g\n",
 		bsphere.center[0], bsphere.center[1],
@@ -85,7 +87,7 @@ static int farthest_vertex_along(const TriMesh &t, const vec &dir)
 // Approximate bounding sphere code based on an algorithm by Ritter
 void TriMesh::need_bsphere()
 {
-	if (vertices.empty() || bsphere.valid)
+	if (vertices.empty() || cache_live(CACHE_BSPHERE))
 		return;
 
 	need_bbox();
@@ -126,6 +128,7 @@ void TriMesh::need_bsphere()
 	}
 
 	bsphere.valid = true; 
+	cache_stamp(CACHE_BSPHERE);
 	dprintf("Done.\n  center = (%g, %g, %g), radius = %g\n",
 		bsphere.center[0], bsphere.center[1],
 		bsphere.center[2], bsphere.r);
@@ -0,0 +1,129 @@
+/*
+TriMesh_cache.cc
+Bookkeeping for the computed properties of a TriMesh: which of them are
+up to date with the current vertices and faces, and how much memory they
+are holding on to.
+*/
+
+#include "TriMesh.h"
+
+
+// What each cached property is computed from
+static const struct {
+	const char *name;
+	bool verts, faces;
+} cache_deps[TriMesh::NUM_CACHES] = {
+	{ "facegeom",      true,  true  },
+	{ "normals",       true,  true  },
+	{ "pointareas",    true,  true  },
+	{ "curvatures",    true,  true  },
+	{ "dcurv",         true,  true  },
+	{ "bbox",          true,  false },
+	{ "bsphere",       true,  false },
+	{ "neighbors",     false, true  },
+	{ "adjacentfaces", false, true  },
+	{ "across_edge",   false, true  },
+	{ "face_dists",    true,  true  },
+};
+
+
+template <class T>
+static inline size_t vec_bytes(const vector<T> &v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+
+template <class T>
+static inline size_t vec_bytes(const vector< vector<T> > &v)
+{
+	size_t bytes = v.capacity() * sizeof(vector<T>);
+	for (size_t i = 0; i < v.size(); i++)
+		bytes += v[i].capacity() * sizeof(T);
+	return bytes;
+}
+
+
+// Is the given property computed, and computed from the current
+// vertices and faces?
+bool TriMesh::cache_live(cache_id c) const
+{
+	if (cache_vgen[c] == 0)
+		return false;
+	if (cache_deps[c].verts && cache_vgen[c] != vert_gen)
+		return false;
+	if (cache_deps[c].faces && cache_fgen[c] != face_gen)
+		return false;
+
+	// Also catch properties that were cleared or resized by hand
+	size_t nv = vertices.size(), nf = faces.size();
+	switch (c) {
+		case CACHE_FACEGEOM:
+			return true;
+		case CACHE_NORMALS:
+			return normals.size() == nv;
+		case CACHE_POINTAREAS:
+			return pointareas.size() == nv &&
+			       cornerareas.size() == nf;
+		case CACHE_CURVATURES:
+			return curv1.size() == nv && curv2.size() == nv &&
+			       pdir1.size() == nv && pdir2.size() == nv;
+		case CACHE_DCURV:
+			return dcurv.size() == nv;
+		case CACHE_BBOX:
+			return bbox.valid;
+		case CACHE_BSPHERE:
+			return bsphere.valid;
+		case CACHE_NEIGHBORS:
+			return neighbors.size() == nv;
+		case CACHE_ADJACENTFACES:
+			return adjacentfaces.size() == nv;
+		case CACHE_ACROSS_EDGE:
+			return across_edge.size() == nf;
+		case CACHE_FACE_DISTS:
+			return dist_faces_across_edge.size() == nf;
+		default:
+			return false;
+	}
+}
+
+
+// Report, for each cached property, whether it is live and how many bytes
+// it occupies (whether or not it is live)
+void TriMesh::cache_info(vector<CacheInfo> &info) const
+{
+	info.resize(NUM_CACHES);
+	for (int i = 0; i < NUM_CACHES; i++) {
+		info[i].name = cache_deps[i].name;
+		info[i].live = cache_live((cache_id) i);
+		info[i].bytes = 0;
+	}
+
+	// Face normals, areas, and centers live inside the faces themselves
+	info[CACHE_FACEGEOM].bytes = faces.size() *
+		(sizeof(vec) + sizeof(float) + sizeof(point));
+	info[CACHE_NORMALS].bytes = vec_bytes(normals);
+	info[CACHE_POINTAREAS].bytes = vec_bytes(pointareas) +
+				       vec_bytes(cornerareas);
+	info[CACHE_CURVATURES].bytes = vec_bytes(curv1) + vec_bytes(curv2) +
+				       vec_bytes(pdir1) + vec_bytes(pdir2);
+	info[CACHE_DCURV].bytes = vec_bytes(dcurv);
+	info[CACHE_BBOX].bytes = sizeof(BBox);
+	info[CACHE_BSPHERE].bytes = sizeof(BSphere);
+	info[CACHE_NEIGHBORS].bytes = vec_bytes(neighbors);
+	info[CACHE_ADJACENTFACES].bytes = vec_bytes(adjacentfaces);
+	info[CACHE_ACROSS_EDGE].bytes = vec_bytes(across_edge);
+	info[CACHE_FACE_DISTS].bytes = vec_bytes(dist_faces_across_edge);
+}
+
+
+// Total memory held by computed properties
+size_t TriMesh::cache_bytes() const
+{
+	vector<CacheInfo> info;
+	cache_info(info);
+	size_t bytes = 0;
+	for (size_t i = 0; i < info.size(); i++)
+		bytes += info[i].bytes;
+	return bytes;
+}
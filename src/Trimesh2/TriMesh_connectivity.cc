@@ -27,7 +27,7 @@ void TriMesh::need_face_indices()
 // Find the direct neighbors of each vertex
 void TriMesh::need_neighbors()
 {
-	if (!neighbors.empty())
+	if (cache_live(CACHE_NEIGHBORS))
 		return;
 	need_faces();
 
@@ -41,6 +41,7 @@ void TriMesh::need_neighbors()
 		numneighbors[faces[i][2]]++;
 	}
 
+	neighbors.clear();
 	neighbors.resize(nv);
 	for (int i = 0; i < nv; i++)
 		neighbors[i].reserve(numneighbors[i]+2); // Slop for boundaries
@@ -57,6 +58,7 @@ void TriMesh::need_neighbors()
 		}
 	}
 
+	cache_stamp(CACHE_NEIGHBORS);
 	dprintf("Done.\n");
 }
 
@@ -64,7 +66,7 @@ void TriMesh::need_neighbors()
 // Find the faces touching each vertex
 void TriMesh::need_adjacentfaces()
 {
-	if (!adjacentfaces.empty())
+	if (cache_live(CACHE_ADJACENTFACES))
 		return;
 	need_faces();
 
@@ -78,6 +80,7 @@ void TriMesh::need_adjacentfaces()
 		numadjacentfaces[faces[i][2]]++;
 	}
 
+	adjacentfaces.clear();
 	adjacentfaces.resize(vertices.size());
 	for (int i = 0; i < nv; i++)
 		adjacentfaces[i].reserve(numadjacentfaces[i]);
@@ -87,22 +90,26 @@ void TriMesh::need_adjacentfaces()
 			adjacentfaces[faces[i][j]].push_back(i);
 	}
 
+	cache_stamp(CACHE_ADJACENTFACES);
 	dprintf("Done.\n");
 }
 
 
-// Find the face across each edge from each other face (-1 on boundary)
+// Find the face across each edge from each other face (the face itself on
+// boundary), and the distances between their centers through the edge.
 // If topology is bad, not necessarily what one would expect...
 void TriMesh::need_across_edge()
 {
-	if (!across_edge.empty())
+	if (cache_live(CACHE_ACROSS_EDGE)) {
+		need_face_dists();
 		return;
+	}
 	need_adjacentfaces();
-	need_normals();
 
 	dprintf("Finding across-edge maps... ");
 
 	int nf = faces.size();
+	across_edge.clear();
 	across_edge.resize(nf, Face(-1,-1,-1));
 
 	for (int i = 0; i < nf; i++) {
@@ -131,10 +138,37 @@ void TriMesh::need_across_edge()
 		}
 	}
 
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (across_edge[i][j] == -1) {
+				across_edge[i][j] = i;
+			}
+		}
+	}
+
+
+	cache_stamp(CACHE_ACROSS_EDGE);
+	dprintf("Done.\n");
+
+	need_face_dists();
+}
+
+
+// Distances between the centers of neighboring faces, through the
+// midpoint of their shared edge (0 on boundary).  These move with the
+// vertices, so they're cached apart from across_edge.
+void TriMesh::need_face_dists()
+{
+	if (cache_live(CACHE_FACE_DISTS))
+		return;
+	need_geometry(GEOM_FACES);
+
+	int nf = faces.size();
+	dist_faces_across_edge.clear();
 	dist_faces_across_edge.resize(nf);
 	for (int i = 0; i < nf; i++) {
 		for (int j = 0; j < 3; j++) {
-			if ( across_edge[i][j] == -1 ) {
+			if (across_edge[i][j] < 0 || across_edge[i][j] == i) {
 				dist_faces_across_edge[i].push_back( 0.0f );
 			} else {
 				int v1 = faces[i][(j+1)%3];
@@ -145,15 +179,6 @@ void TriMesh::need_across_edge()
 		}
 	}
 
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++) {
-			if (across_edge[i][j] == -1) {
-				across_edge[i][j] = i;
-			}
-		}
-	}
-
-
-	dprintf("Done.\n");
+	cache_stamp(CACHE_FACE_DISTS);
 }
 
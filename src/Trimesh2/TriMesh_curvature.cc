@@ -132,14 +132,29 @@ void diagonalize_curv(const vec &old_u, const vec &old_v,
 }
 
 
+// N-T-B coordinate system of face i, given its edges
+static inline void face_coords(const vec e[3], vec &t, vec &b)
+{
+	t = e[0];
+	normalize(t);
+	vec n = e[0] CROSS e[1];
+	b = n CROSS t;
+	normalize(b);
+}
+
+
 // Compute principal curvatures and directions.
+// Each stage is either per-face or per-vertex: the per-face results are
+// kept in temporary arrays, and each vertex then gathers from its
+// adjacentfaces in face order.  This gives the same sums as scattering
+// from the faces serially, but can run in parallel.
 void TriMesh::need_curvatures()
 {
-	if (curv1.size() == vertices.size())
+	if (cache_live(CACHE_CURVATURES))
 		return;
 	need_faces();
-	need_normals();
-	need_pointareas();
+	need_adjacentfaces();
+	need_geometry(GEOM_NORMALS | GEOM_POINTAREAS);
 
 //	dprintf("Computing curvatures... ");
 
@@ -149,25 +164,26 @@ void TriMesh::need_curvatures()
 	pdir1.clear(); pdir1.resize(nv); pdir2.clear(); pdir2.resize(nv);
 	vector<float> curv12(nv);
 
-	// Set up an initial coordinate system per vertex
-//#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		pdir1[faces[i][0]] = vertices[faces[i][1]] -
-				     vertices[faces[i][0]];
-		pdir1[faces[i][1]] = vertices[faces[i][2]] -
-				     vertices[faces[i][1]];
-		pdir1[faces[i][2]] = vertices[faces[i][0]] -
-				     vertices[faces[i][2]];
-	}
-//#pragma omp parallel for
+	// Set up an initial coordinate system per vertex: the edge leaving
+	// the vertex in the last face that touches it
+#pragma omp parallel for
 	for (int i = 0; i < nv; i++) {
+		if (!adjacentfaces[i].empty()) {
+			const Face &f = faces[adjacentfaces[i].back()];
+			for (int j = 0; j < 3; j++)
+				if (f[j] == i)
+					pdir1[i] = vertices[f[NEXT(j)]] -
+						   vertices[i];
+		}
 		pdir1[i] = pdir1[i] CROSS normals[i];
 		normalize(pdir1[i]);
 		pdir2[i] = normals[i] CROSS pdir1[i];
 	}
 
 	// Compute curvature per-face
-//#pragma omp parallel for
+	vector<vec> ft(nf), fb(nf), fcurv(nf);
+	vector<char> fok(nf);
+#pragma omp parallel for
 	for (int i = 0; i < nf; i++) {
 		// Edges
 		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
@@ -175,11 +191,8 @@ void TriMesh::need_curvatures()
 			     vertices[faces[i][1]] - vertices[faces[i][0]] };
 
 		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] CROSS e[1];
-		vec b = n CROSS t;
-		normalize(b);
+		vec t, b;
+		face_coords(e, t, b);
 
 		// Estimate curvature based on variation of normals
 		// along edges
@@ -211,37 +224,53 @@ void TriMesh::need_curvatures()
 			continue;
 		}
 		ldltsl<float,3>(w, diag, m, m);
-
-		// Push it back out to the vertices
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			float c1, c12, c2;
-			proj_curv(t, b, m[0], m[1], m[2],
-				  pdir1[vj], pdir2[vj], c1, c12, c2);
-			float wt = cornerareas[i][j] / pointareas[vj];
-			curv1[vj]  += wt * c1;
-			curv12[vj] += wt * c12;
-			curv2[vj]  += wt * c2;
-		}
+		ft[i] = t;
+		fb[i] = b;
+		fcurv[i] = vec(m);
+		fok[i] = 1;
 	}
 
-	// Compute principal directions and curvatures at each vertex
-//#pragma omp parallel for
-	for (int i = 0; i < nv; i++)
+	// Pull the face curvatures in to each vertex, then compute principal
+	// directions and curvatures
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		const vector<int> &a = adjacentfaces[i];
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			// Degenerate faces are listed once per corner
+			if (!fok[f] || (k > 0 && a[k-1] == f))
+				continue;
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				float c1, c12, c2;
+				proj_curv(ft[f], fb[f],
+					  fcurv[f][0], fcurv[f][1], fcurv[f][2],
+					  pdir1[i], pdir2[i], c1, c12, c2);
+				float wt = cornerareas[f][j] / pointareas[i];
+				curv1[i]  += wt * c1;
+				curv12[i] += wt * c12;
+				curv2[i]  += wt * c2;
+			}
+		}
 		diagonalize_curv(pdir1[i], pdir2[i],
 				 curv1[i], curv12[i], curv2[i],
 				 normals[i], pdir1[i], pdir2[i],
 				 curv1[i], curv2[i]);
+	}
+	cache_stamp(CACHE_CURVATURES);
 	//dprintf("Done.\n");
 }
 
 
 // Compute derivatives of curvature.
+// Same structure as need_curvatures: per-face fits, then per-vertex gathers.
 void TriMesh::need_dcurv()
 {
-	if (dcurv.size() == vertices.size())
+	if (cache_live(CACHE_DCURV))
 		return;
 	need_curvatures();
+	need_adjacentfaces();
 
 	//dprintf("Computing dcurv... ");
 
@@ -250,7 +279,10 @@ void TriMesh::need_dcurv()
 	dcurv.clear(); dcurv.resize(nv);
 
 	// Compute dcurv per-face
-//#pragma omp parallel for
+	vector<vec> ft(nf), fb(nf);
+	vector< Vec<4> > fdcurv(nf);
+	vector<char> fok(nf);
+#pragma omp parallel for
 	for (int i = 0; i < nf; i++) {
 		// Edges
 		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
@@ -258,11 +290,8 @@ void TriMesh::need_dcurv()
 			     vertices[faces[i][1]] - vertices[faces[i][0]] };
 
 		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] CROSS e[1];
-		vec b = n CROSS t;
-		normalize(b);
+		vec t, b;
+		face_coords(e, t, b);
 
 		// Project curvature tensor from each vertex into this
 		// face's coordinate system
@@ -307,19 +336,32 @@ void TriMesh::need_dcurv()
 			continue;
 		}
 		ldltsl<float,4>(w, d, m, m);
-		Vec<4> face_dcurv(m);
+		ft[i] = t;
+		fb[i] = b;
+		fdcurv[i] = Vec<4>(m);
+		fok[i] = 1;
+	}
 
-		// Push it back out to each vertex
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			Vec<4> this_vert_dcurv;
-			proj_dcurv(t, b, face_dcurv,
-				   pdir1[vj], pdir2[vj], this_vert_dcurv);
-			float wt = cornerareas[i][j] / pointareas[vj];
-			dcurv[vj] += wt * this_vert_dcurv;
+	// Pull it in to each vertex
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		const vector<int> &a = adjacentfaces[i];
+		for (size_t k = 0; k < a.size(); k++) {
+			int f = a[k];
+			if (!fok[f] || (k > 0 && a[k-1] == f))
+				continue;
+			for (int j = 0; j < 3; j++) {
+				if (faces[f][j] != i)
+					continue;
+				Vec<4> this_vert_dcurv;
+				proj_dcurv(ft[f], fb[f], fdcurv[f],
+					   pdir1[i], pdir2[i], this_vert_dcurv);
+				float wt = cornerareas[f][j] / pointareas[i];
+				dcurv[i] += wt * this_vert_dcurv;
+			}
 		}
 	}
 
+	cache_stamp(CACHE_DCURV);
 	//dprintf("Done.\n");
 }
-
@@ -0,0 +1,173 @@
+/*
+TriMesh_geometry.cc
+Fused per-face geometry: face normals, areas, and centers, per-vertex
+normals, and corner/point areas, all from one pass over the faces.
+
+If adjacentfaces is available, the per-face work runs in parallel and each
+vertex then gathers from its faces; otherwise it is a single serial loop.
+Either way the per-vertex sums are accumulated in face order.
+*/
+
+#include <stdio.h>
+#include "TriMesh.h"
+
+
+// Corner areas of one face (Voronoi area restricted to the triangle),
+// given its edges and area.  Same cases as in TriMesh_pointareas.cc.
+static inline void corner_areas(const vec e[3], float area, vec &ca)
+{
+	float l2[3] = { len2(e[0]), len2(e[1]), len2(e[2]) };
+	float ew[3] = { l2[0] * (l2[1] + l2[2] - l2[0]),
+			l2[1] * (l2[2] + l2[0] - l2[1]),
+			l2[2] * (l2[0] + l2[1] - l2[2]) };
+	if (ew[0] <= 0.0f) {
+		ca[1] = -0.25f * l2[2] * area / (e[0] DOT e[2]);
+		ca[2] = -0.25f * l2[1] * area / (e[0] DOT e[1]);
+		ca[0] = area - ca[1] - ca[2];
+	} else if (ew[1] <= 0.0f) {
+		ca[2] = -0.25f * l2[0] * area / (e[1] DOT e[0]);
+		ca[0] = -0.25f * l2[2] * area / (e[1] DOT e[2]);
+		ca[1] = area - ca[2] - ca[0];
+	} else if (ew[2] <= 0.0f) {
+		ca[0] = -0.25f * l2[1] * area / (e[2] DOT e[1]);
+		ca[1] = -0.25f * l2[0] * area / (e[2] DOT e[0]);
+		ca[2] = area - ca[0] - ca[1];
+	} else {
+		float ewscale = 0.5f * area / (ew[0] + ew[1] + ew[2]);
+		for (int j = 0; j < 3; j++)
+			ca[j] = ewscale * (ew[(j+1)%3] + ew[(j+2)%3]);
+	}
+}
+
+
+// Compute the requested per-face and per-vertex geometry (a combination
+// of GEOM_FACES, GEOM_NORMALS, and GEOM_POINTAREAS) in a single pass.
+// Anything that is already up to date is skipped.
+void TriMesh::need_geometry(int which)
+{
+	need_faces();
+	if (cache_live(CACHE_FACEGEOM))
+		which &= ~GEOM_FACES;
+	if (cache_live(CACHE_NORMALS))
+		which &= ~GEOM_NORMALS;
+	if (cache_live(CACHE_POINTAREAS))
+		which &= ~GEOM_POINTAREAS;
+
+	int nf = faces.size(), nv = vertices.size();
+	if (nf == 0) {
+		// Point cloud: nothing per-face to share
+		if (which & GEOM_NORMALS)
+			need_normals();
+		if (which & GEOM_POINTAREAS) {
+			pointareas.clear();
+			pointareas.resize(nv);
+			cornerareas.clear();
+			cache_stamp(CACHE_POINTAREAS);
+		}
+		return;
+	}
+	if (which & GEOM_NORMALS)
+		which |= GEOM_FACES;
+	bool do_faces = (which & GEOM_FACES), do_normals = (which & GEOM_NORMALS),
+	     do_areas = (which & GEOM_POINTAREAS);
+	if (!do_faces && !do_areas)
+		return;
+
+	dprintf("Computing face geometry... ");
+
+	if (do_normals) {
+		normals.clear();
+		normals.resize(nv);
+	}
+	if (do_areas) {
+		pointareas.clear();
+		pointareas.resize(nv);
+		cornerareas.clear();
+		cornerareas.resize(nf);
+	}
+
+	// Without adjacentfaces, there is no race-free way to sum per vertex,
+	// so do everything in one serial loop.  With it, run the per-face
+	// part in parallel and have each vertex gather its faces afterwards.
+	bool gather = ((int) adjacentfaces.size() == nv) &&
+		      (do_normals || do_areas);
+
+	// Weights of the face normal at each corner, for the vertex normals
+	vector<vec> nweights;
+	if (gather && do_normals)
+		nweights.resize(nf);
+
+#pragma omp parallel for if (gather)
+	for (int i = 0; i < nf; i++) {
+		Face &f = faces[i];
+		const point &p0 = vertices[f[0]];
+		const point &p1 = vertices[f[1]];
+		const point &p2 = vertices[f[2]];
+
+		// Edges, each opposite the corresponding vertex.  The normal
+		// is the same product need_normals uses: (p0-p1) x (p1-p2).
+		vec e[3] = { p2 - p1, p0 - p2, p1 - p0 };
+		vec fn = (e[2] CROSS e[0]) + vec(1e-37f, 1e-37f, 1e-37f);
+		float area = 0.5f * len(fn);
+
+		if (do_faces) {
+			f.facenormal = fn;
+			f.faceArea = area;
+			f.faceCenter = (p0 + p1 + p2) / 3.0f;
+		}
+		vec nw;
+		if (do_normals) {
+			float l2a = len2(e[2]), l2b = len2(e[0]),
+			      l2c = len2(e[1]);
+			nw[0] = 1.0f / (l2a * l2c + 1e-27f);
+			nw[1] = 1.0f / (l2b * l2a + 1e-27f);
+			nw[2] = 1.0f / (l2c * l2b + 1e-27f);
+		}
+		if (do_areas)
+			corner_areas(e, area, cornerareas[i]);
+
+		if (gather) {
+			if (do_normals)
+				nweights[i] = nw;
+			continue;
+		}
+		for (int j = 0; j < 3; j++) {
+			if (do_normals)
+				normals[f[j]] += fn * nw[j];
+			if (do_areas)
+				pointareas[f[j]] += cornerareas[i][j];
+		}
+	}
+
+	if (gather) {
+		// Each vertex sums its own faces, in face order, so the
+		// result is the same as for the serial loop
+#pragma omp parallel for
+		for (int v = 0; v < nv; v++) {
+			const vector<int> &a = adjacentfaces[v];
+			for (size_t k = 0; k < a.size(); k++) {
+				int i = a[k];
+				// Degenerate faces are listed once per corner
+				if (k > 0 && a[k-1] == i)
+					continue;
+				for (int j = 0; j < 3; j++) {
+					if (faces[i][j] != v)
+						continue;
+					if (do_normals)
+						normals[v] += faces[i].facenormal *
+							      nweights[i][j];
+					if (do_areas)
+						pointareas[v] += cornerareas[i][j];
+				}
+			}
+		}
+	}
+
+	if (do_faces)
+		cache_stamp(CACHE_FACEGEOM);
+	if (do_normals)
+		cache_stamp(CACHE_NORMALS);
+	if (do_areas)
+		cache_stamp(CACHE_POINTAREAS);
+	dprintf("Done.\n");
+}
@@ -102,6 +102,7 @@ void TriMesh::triangulate_grid()
 		}
 	}
 
+	faces_changed();
 	dprintf("%lu faces.\n  ", ntris);
 	remove_sliver_faces(this);
 	dprintf("  ");
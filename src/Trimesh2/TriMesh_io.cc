@@ -14,6 +14,7 @@ Can write: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, C++
 #include <ctype.h>
 #include <stdarg.h>
 #include "TriMesh.h"
+#include "TriMesh_stream.h"
 //#include <boost/filesystem.hpp>
 //#include <conio.h>
 
@@ -29,8 +30,29 @@ Can write: PLY (triangle mesh and range grid), OFF, OBJ, RAY, SM, C++
 
 #define BIGNUM 1.0e10
 
+// Binary vertex and face lists are read in blocks of about this many bytes
+#define READ_BLOCK_BYTES (1 << 22)
+
 
 // Forward declarations
+// Layout of a ply file, from its header.  Offsets are in bytes for binary
+// files, and in fields for ASCII ones; -1 means not present.
+struct PlyHeader {
+	bool binary, need_swap, float_color;
+	int nverts, nfaces, nstrips, ngrid;
+	int vert_len, vert_pos, vert_norm, vert_color, vert_conf;
+	int face_len, face_count, face_idx;
+	int skip1, skip2;	// Other elements before vertices / faces
+	PlyHeader() : binary(false), need_swap(false), float_color(false),
+		nverts(0), nfaces(0), nstrips(0), ngrid(0),
+		vert_len(0), vert_pos(-1), vert_norm(-1), vert_color(-1),
+		vert_conf(-1), face_len(0), face_count(-1), face_idx(-1),
+		skip1(0), skip2(0)
+		{}
+};
+
+static bool read_ply_header(FILE *f, PlyHeader &h, int &grid_width,
+			    int &grid_height);
 static bool read_ply(FILE *f, TriMesh *mesh);
 static bool read_3ds(FILE *f, TriMesh *mesh);
 static bool read_vvd(FILE *f, TriMesh *mesh);
@@ -43,8 +65,6 @@ static bool read_sm( FILE *f, TriMesh *mesh);
 static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 	int nverts, int vert_len, int vert_pos, int vert_norm,
 	int vert_color, bool float_color, int vert_conf);
-static bool slurp_verts_bin(FILE *f, TriMesh *mesh, bool need_swap,
-	int nverts);
 static bool read_verts_asc(FILE *f, TriMesh *mesh,
 	int nverts, int vert_len, int vert_pos, int vert_norm,
 	int vert_color, bool float_color, int vert_conf);
@@ -60,7 +80,6 @@ static bool read_grid_asc(FILE *f, TriMesh *mesh);
 static bool ply_property(const char *buf, int &len, bool binary);
 static bool we_are_little_endian();
 static void check_need_swap(const point &p, bool &need_swap);
-static void check_ind_range(TriMesh *mesh);
 static void skip_comments(FILE *f);
 static void tess(const vector<point> &verts, const vector<int> &thisface,
 		 vector<Face> &tris, vector<int> *thisvertt = 0);
@@ -138,6 +157,53 @@ static inline void swap_short(signed short &x)
 	swap_ushort(* (unsigned short *)(&x));
 }
 
+// Byte swap an array of n 4-byte values (uints, ints, or floats).  A plain
+// loop over independent words, which the compiler turns into vector
+// shuffles.
+static void swap_4byte_array(void *p, size_t n)
+{
+	unsigned *u = (unsigned *) p;
+	for (size_t i = 0; i < n; i++) {
+		unsigned x = u[i];
+		u[i] = (x << 24u) |
+		       ((x << 8u) & 0x00ff0000u) |
+		       ((x >> 8u) & 0x0000ff00u) |
+		       (x >> 24u);
+	}
+}
+
+// Copy the LEN-byte field at offset off of each of n records of length
+// stride into consecutive slots of dst
+template <int LEN>
+static void gather_field(void *dst, const unsigned char *src, size_t n,
+			 int stride, int off)
+{
+	unsigned char *d = (unsigned char *) dst;
+	src += off;
+	for (size_t i = 0; i < n; i++, d += LEN, src += stride)
+		memcpy(d, src, LEN);
+}
+
+// Make sure there are at least need bytes in buf[pos, end), reading up to
+// want bytes if the file has them.  Returns false if the file ends first.
+static bool fill_buf(FILE *f, vector<unsigned char> &buf,
+		     size_t &pos, size_t &end, size_t need, size_t want)
+{
+	if (end - pos >= need)
+		return true;
+	if (pos > 0) {
+		if (end > pos)
+			memmove(&buf[0], &buf[pos], end - pos);
+		end -= pos;
+		pos = 0;
+	}
+	want = max(want, need);
+	if (buf.size() < want)
+		buf.resize(want);
+	end += fread(&buf[end], 1, want - end, f);
+	return end >= need;
+}
+
 
 
 // unget a whole string of characters
@@ -276,33 +342,314 @@ out:
 	}
 
 	dprintf("Done.\n");
-	check_ind_range(mesh);
+
+	// Check whether the indices in the file mistakenly go
+	// from 1..N instead of 0..N-1, and whether any are out of range.
+	// Duplicates and non-manifold edges are left to callers that want
+	// them, since checking costs about as much as the read.
+	mesh->validation = mesh->validate(REPAIR_OFFSET, false);
+	if (mesh->validation.offset)
+		dprintf("Remapped indices starting at %d to start at 0\n",
+			mesh->validation.offset);
 	return true;
 }
 
 
-// Read a ply file
-static bool read_ply(FILE *f, TriMesh *mesh)
+// Hand the vertices accumulated in a scratch mesh to a stream handler,
+// and clear them out for the next chunk
+static bool stream_verts(TriMesh *tmp, MeshVertexChunk &chunk,
+			 MeshStreamHandler &handler)
+{
+	int n = tmp->vertices.size();
+	if (!n)
+		return true;
+	chunk.vertices.swap(tmp->vertices);
+	chunk.normals.swap(tmp->normals);
+	chunk.colors.swap(tmp->colors);
+	chunk.confidences.swap(tmp->confidences);
+	bool ok = handler.vertices(chunk);
+	chunk.first += n;
+
+	// Hang on to the storage for next time
+	chunk.vertices.swap(tmp->vertices);
+	chunk.normals.swap(tmp->normals);
+	chunk.colors.swap(tmp->colors);
+	chunk.confidences.swap(tmp->confidences);
+	tmp->vertices.clear();
+	tmp->normals.clear();
+	tmp->colors.clear();
+	tmp->confidences.clear();
+	return ok;
+}
+
+
+// Same, for faces
+static bool stream_faces(TriMesh *tmp, MeshFaceChunk &chunk,
+			 MeshStreamHandler &handler)
+{
+	int n = tmp->faces.size();
+	if (!n)
+		return true;
+	chunk.inds.resize(3 * n);
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < 3; j++)
+			chunk.inds[3*i+j] = tmp->faces[i][j];
+	tmp->faces.clear();
+	bool ok = handler.faces(chunk);
+	chunk.first += n;
+	return ok;
+}
+
+
+// Stream a ply file, reading the vertex and face lists a piece at a time
+// with the same routines read_ply uses
+static bool stream_ply(FILE *f, MeshStreamHandler &handler, int chunk_size)
+{
+	TriMesh tmp;
+	PlyHeader h;
+	if (!read_ply_header(f, h, tmp.grid_width, tmp.grid_height))
+		return false;
+	if (h.nstrips || h.ngrid) {
+		fprintf(stderr, "Can't stream triangle strips or range grids\n");
+		return false;
+	}
+	if (!handler.begin(h.nverts, h.nfaces))
+		return false;
+
+	char buf[1024];
+	if (h.skip1) {
+		if (h.binary)
+			fseek(f, h.skip1, SEEK_CUR);
+		else
+			for (int i = 0; i < h.skip1; i++)
+				fscanf(f, "%s", buf);
+	}
+	MeshVertexChunk vchunk;
+	vchunk.first = 0;
+	for (int i = 0; i < h.nverts; i += chunk_size) {
+		int n = min(chunk_size, h.nverts - i);
+		bool ok = h.binary ?
+			read_verts_bin(f, &tmp, h.need_swap, n, h.vert_len,
+				       h.vert_pos, h.vert_norm, h.vert_color,
+				       h.float_color, h.vert_conf) :
+			read_verts_asc(f, &tmp, n, h.vert_len,
+				       h.vert_pos, h.vert_norm, h.vert_color,
+				       h.float_color, h.vert_conf);
+		if (!ok || !stream_verts(&tmp, vchunk, handler))
+			return false;
+	}
+
+	if (h.skip2) {
+		if (h.binary)
+			fseek(f, h.skip2, SEEK_CUR);
+		else
+			for (int i = 0; i < h.skip2; i++)
+				fscanf(f, "%s", buf);
+	}
+	MeshFaceChunk fchunk;
+	fchunk.first = 0;
+	for (int i = 0; i < h.nfaces; i += chunk_size) {
+		int n = min(chunk_size, h.nfaces - i);
+		bool ok = h.binary ?
+			read_faces_bin(f, &tmp, h.need_swap, n,
+				       h.face_len, h.face_count, h.face_idx) :
+			read_faces_asc(f, &tmp, n,
+				       h.face_len, h.face_count, h.face_idx);
+		if (!ok || !stream_faces(&tmp, fchunk, handler))
+			return false;
+	}
+
+	return handler.end();
+}
+
+
+// Stream an OFF file
+static bool stream_off(FILE *f, MeshStreamHandler &handler, int chunk_size)
+{
+	skip_comments(f);
+	char buf[1024];
+	GET_LINE();
+	int nverts, nfaces, unused;
+	if (sscanf(buf, "%d %d %d", &nverts, &nfaces, &unused) < 2)
+		return false;
+	if (!handler.begin(nverts, nfaces))
+		return false;
+
+	TriMesh tmp;
+	MeshVertexChunk vchunk;
+	vchunk.first = 0;
+	for (int i = 0; i < nverts; i += chunk_size) {
+		int n = min(chunk_size, nverts - i);
+		if (!read_verts_asc(f, &tmp, n, 3, 0, -1, -1, false, -1) ||
+		    !stream_verts(&tmp, vchunk, handler))
+			return false;
+	}
+	MeshFaceChunk fchunk;
+	fchunk.first = 0;
+	for (int i = 0; i < nfaces; i += chunk_size) {
+		int n = min(chunk_size, nfaces - i);
+		if (!read_faces_asc(f, &tmp, n, 1, 0, 1, true) ||
+		    !stream_faces(&tmp, fchunk, handler))
+			return false;
+	}
+
+	return handler.end();
+}
+
+
+// Stream an obj file: vertex positions (and colors) and faces only.
+// Polygons are split into fans.  Once a vertex has a color, every vertex
+// from the start of its chunk on gets one, black if the file has none.
+static bool stream_obj(FILE *f, MeshStreamHandler &handler, int chunk_size)
+{
+	if (!handler.begin(-1, -1))
+		return false;
+
+	TriMesh tmp;
+	MeshVertexChunk vchunk;
+	vchunk.first = 0;
+	MeshFaceChunk fchunk;
+	fchunk.first = 0;
+	int nverts = 0;
+	bool have_colors = false;
+	vector<int> thisface;
+	while (1) {
+		skip_comments(f);
+		if (feof(f))
+			break;
+		char buf[1024];
+		if (!fgets(buf, 1024, f))
+			break;
+		if (LINE_IS("v ") || LINE_IS("v\t")) {
+			float x, y, z, r, g, b;
+			int nread = sscanf(buf+1, "%f %f %f %f %f %f",
+					   &x, &y, &z, &r, &g, &b);
+			if (nread < 3)
+				return false;
+			tmp.vertices.push_back(point(x,y,z));
+			if (nread == 6 && !have_colors) {
+				tmp.colors.resize(tmp.vertices.size() - 1, Color(0,0,0));
+				have_colors = true;
+			}
+			if (nread == 6)
+				tmp.colors.push_back(Color(r * 255, g * 255, b * 255));
+			else if (have_colors)
+				tmp.colors.push_back(Color(0,0,0));
+			nverts++;
+			if ((int) tmp.vertices.size() >= chunk_size &&
+			    !stream_verts(&tmp, vchunk, handler))
+				return false;
+		} else if (LINE_IS("f ") || LINE_IS("f\t") ||
+			   LINE_IS("t ") || LINE_IS("t\t")) {
+			// Vertex index is the first number of each v/vt/vn
+			thisface.clear();
+			char *c = buf + 1;
+			while (1) {
+				while (*c && isspace(*c))
+					c++;
+				char *next;
+				long ind = strtol(c, &next, 10);
+				if (next == c)
+					break;
+				thisface.push_back(ind < 0 ? ind + nverts : ind - 1);
+				c = next;
+				while (*c && !isspace(*c))
+					c++;
+			}
+			for (size_t i = 2; i < thisface.size(); i++)
+				tmp.faces.push_back(Face(thisface[0],
+					thisface[i-1], thisface[i]));
+
+			// Faces may only go out after their vertices
+			if ((int) tmp.faces.size() >= chunk_size &&
+			    (!stream_verts(&tmp, vchunk, handler) ||
+			     !stream_faces(&tmp, fchunk, handler)))
+				return false;
+		}
+	}
+
+	if (!stream_verts(&tmp, vchunk, handler) ||
+	    !stream_faces(&tmp, fchunk, handler))
+		return false;
+	return handler.end();
+}
+
+
+// Read a mesh a chunk at a time, handing the pieces to a handler instead of
+// keeping them.  Handles ply, obj, and off files.
+bool read_stream(const char *filename, MeshStreamHandler &handler,
+		 int chunk_size /* = MESH_STREAM_CHUNK */)
+{
+	if (!filename || *filename == '\0')
+		return false;
+	if (chunk_size <= 0)
+		chunk_size = MESH_STREAM_CHUNK;
+
+	FILE *f;
+	if (strcmp(filename, "-") == 0) {
+		f = stdin;
+		filename = "standard input";
+	} else {
+		f = fopen(filename, "rb");
+		if (!f) {
+			perror("fopen");
+			return false;
+		}
+	}
+	TriMesh::dprintf("Streaming %s... ", filename);
+
+	// The per-chunk readers would each announce themselves
+	int old_verbose = TriMesh::verbose;
+	TriMesh::verbose = 0;
+
+	bool ok = false;
+	char buf[4];
+	int c = fgetc(f);
+	if (c == 'p') {
+		if (fgets(buf, 4, f) && strncmp(buf, "ly", 2) == 0)
+			ok = stream_ply(f, handler, chunk_size);
+	} else if (c == 'O') {
+		if (fgets(buf, 3, f) && strncmp(buf, "FF", 2) == 0)
+			ok = stream_off(f, handler, chunk_size);
+	} else if (c == '#' || c == 'v' || c == 'u' || c == 'f' || c == 'g' ||
+		   c == 's' || c == 'o' || c == 'm') {
+		ungetc(c, f);
+		ok = stream_obj(f, handler, chunk_size);
+	} else {
+		fprintf(stderr, "Can't stream this file type\n");
+	}
+
+	TriMesh::verbose = old_verbose;
+	if (f != stdin)
+		fclose(f);
+	if (!ok) {
+		fprintf(stderr, "\nError streaming file [%s]\n", filename);
+		return false;
+	}
+	TriMesh::dprintf("Done.\n");
+	return true;
+}
+
+
+// Parse the header of a ply file, leaving f at the start of the data
+static bool read_ply_header(FILE *f, PlyHeader &h, int &grid_width,
+			    int &grid_height)
 {
-	char buf[1024];	
-	bool binary = false, need_swap = false, float_color = false;
-	int result, nverts = 0, nfaces = 0, nstrips = 0, ngrid = 0;
-	int vert_len = 0, vert_pos = -1, vert_norm = -1;
-	int vert_color = -1, vert_conf = -1;
-	int face_len = 0, face_count = -1, face_idx = -1;
+	char buf[1024];
+	int result;
 
 	// Read file format
 	GET_LINE();
 	while (buf[0] && isspace(buf[0]))
 		GET_LINE();
 	if (LINE_IS("format binary_big_endian 1.0")) {
-		binary = true;
-		need_swap = we_are_little_endian();
+		h.binary = true;
+		h.need_swap = we_are_little_endian();
 	} else if (LINE_IS("format binary_little_endian 1.0")) {
-		binary = true;
-		need_swap = !we_are_little_endian();
+		h.binary = true;
+		h.need_swap = !we_are_little_endian();
 	} else if (LINE_IS("format ascii 1.0")) {
-		binary = false;
+		h.binary = false;
 	} else {
 		fprintf(stderr, "Unknown ply format or version\n");
 		return false;
@@ -312,29 +659,28 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	GET_LINE();
 	while (LINE_IS("obj_info") || LINE_IS("comment")) {
 		if (LINE_IS("obj_info num_cols"))
-			sscanf(buf, "obj_info num_cols %d", &mesh->grid_width);
+			sscanf(buf, "obj_info num_cols %d", &grid_width);
 		if (LINE_IS("obj_info num_rows"))
-			sscanf(buf, "obj_info num_rows %d", &mesh->grid_height);
+			sscanf(buf, "obj_info num_rows %d", &grid_height);
 		GET_LINE();
 	}
 
 	// Skip until we find vertices
-	int skip1 = 0;
 	while (!LINE_IS("end_header") && !LINE_IS("element vertex")) {
 		char elem_name[1024];
 		int nelem = 0, elem_len = 0;
 		sscanf(buf, "element %s %d", elem_name, &nelem);
 		GET_LINE();
 		while (LINE_IS("property")) {
-			if (!ply_property(buf, elem_len, binary))
+			if (!ply_property(buf, elem_len, h.binary))
 				return false;
 			GET_LINE();
 		}
-		skip1 += nelem * elem_len;
+		h.skip1 += nelem * elem_len;
 	}
 
 	// Find number of vertices
-	result = sscanf(buf, "element vertex %d\n", &nverts);
+	result = sscanf(buf, "element vertex %d\n", &h.nverts);
 	if (result != 1) {
 		fprintf(stderr, "Expected \"element vertex\"\n");
 		return false;
@@ -345,32 +691,31 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	while (LINE_IS("property")) {
 		if (LINE_IS("property float x") ||
 		    LINE_IS("property float32 x"))
-			vert_pos = vert_len;
+			h.vert_pos = h.vert_len;
 		if (LINE_IS("property float nx") ||
 		    LINE_IS("property float32 nx"))
-			vert_norm = vert_len;
+			h.vert_norm = h.vert_len;
 		if (LINE_IS("property uchar diffuse_red") ||
 		    LINE_IS("property uint8 diffuse_red") ||
 		    LINE_IS("property uchar red") ||
 		    LINE_IS("property uint8 red"))
-			vert_color = vert_len;
+			h.vert_color = h.vert_len;
 		if (LINE_IS("property float diffuse_red") ||
 		    LINE_IS("property float32 diffuse_red") ||
 		    LINE_IS("property float red") ||
 		    LINE_IS("property float32 red"))
-			vert_color = vert_len, float_color = true;
+			h.vert_color = h.vert_len, h.float_color = true;
 		if (LINE_IS("property float confidence") ||
 		    LINE_IS("property float32 confidence"))
-			vert_conf = vert_len;
+			h.vert_conf = h.vert_len;
 
-		if (!ply_property(buf, vert_len, binary))
+		if (!ply_property(buf, h.vert_len, h.binary))
 			return false;
 
 		GET_LINE();
 	}
 
 	// Skip until we find faces
-	int skip2 = 0;
 	while (!LINE_IS("end_header") && !LINE_IS("element face") &&
 	       !LINE_IS("element tristrips") && !LINE_IS("element range_grid")) {
 		char elem_name[1024];
@@ -378,17 +723,17 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 		sscanf(buf, "element %s %d", elem_name, &nelem);
 		GET_LINE();
 		while (LINE_IS("property")) {
-			if (!ply_property(buf, elem_len, binary))
+			if (!ply_property(buf, elem_len, h.binary))
 				return false;
 			GET_LINE();
 		}
-		skip2 += nelem * elem_len;
+		h.skip2 += nelem * elem_len;
 	}
 
 
 	// Look for faces, tristrips, or range grid
 	if (LINE_IS("element face")) {
-		if (sscanf(buf, "element face %d\n", &nfaces) != 1)
+		if (sscanf(buf, "element face %d\n", &h.nfaces) != 1)
 			return false;
 		GET_LINE();
 		while (LINE_IS("property")) {
@@ -400,9 +745,9 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 			    LINE_IS("property list uint8 int32 vertex_index") ||
 			    LINE_IS("property list char int vertex_index") ||
 			    LINE_IS("property list int8 int32 vertex_index")) {
-				face_count = face_len;
-				face_idx = face_len + 1;
-				face_len += 1;
+				h.face_count = h.face_len;
+				h.face_idx = h.face_len + 1;
+				h.face_len += 1;
 			} else if
 			   (LINE_IS("property list uint int vertex_indices") ||
 			    LINE_IS("property list uint32 int32 vertex_indices") ||
@@ -412,24 +757,24 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 			    LINE_IS("property list uint32 int32 vertex_index") ||
 			    LINE_IS("property list int int vertex_index") ||
 			    LINE_IS("property list int32 int32 vertex_index")) {
-				face_count = face_len;
-				face_idx = face_len + (binary ? 4 : 1);
-				face_len += (binary ? 4 : 1);
-			} else if (!ply_property(buf, face_len, binary))
+				h.face_count = h.face_len;
+				h.face_idx = h.face_len + (h.binary ? 4 : 1);
+				h.face_len += (h.binary ? 4 : 1);
+			} else if (!ply_property(buf, h.face_len, h.binary))
 				return false;
 			GET_LINE();
 		}
 	} else if (LINE_IS("element tristrips")) {
-		nstrips = 1;
+		h.nstrips = 1;
 		GET_LINE();
 		if (!LINE_IS("property list int int vertex_indices") &&
 		    !LINE_IS("property list int32 int32 vertex_indices"))
 			return false;
 		GET_LINE();
 	} else if (LINE_IS("element range_grid")) {
-		if (sscanf(buf, "element range_grid %d\n", &ngrid) != 1)
+		if (sscanf(buf, "element range_grid %d\n", &h.ngrid) != 1)
 			return false;
-		if (ngrid != mesh->grid_width*mesh->grid_height) {
+		if (h.ngrid != grid_width*grid_height) {
 			fprintf(stderr, "Range grid size does not equal num_rows*num_cols\n");
 			return false;
 		}
@@ -443,7 +788,7 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	}
 
 	while (LINE_IS("property")) {
-		if (!ply_property(buf, face_len, binary))
+		if (!ply_property(buf, h.face_len, h.binary))
 			return false;
 		GET_LINE();
 	}
@@ -451,50 +796,62 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	// Skip to the end of the header
 	while (!LINE_IS("end_header"))
 		GET_LINE();
-	if (binary && buf[10] == '\r') {
+	if (h.binary && buf[10] == '\r') {
 		fprintf(stderr, "Warning!  Possibly corrupt file\n");
 		fprintf(stderr, "     If things don't work, make sure this file was transferred in BINARY, not ASCII mode\n");
 	}
 
+	return true;
+}
+
+
+// Read a ply file
+static bool read_ply(FILE *f, TriMesh *mesh)
+{
+	PlyHeader h;
+	if (!read_ply_header(f, h, mesh->grid_width, mesh->grid_height))
+		return false;
+	char buf[1024];
+	bool need_swap = h.need_swap;
 
 	// Actually read everything in
-	if (skip1) {
-		if (binary)
-			fseek(f, skip1, SEEK_CUR);
+	if (h.skip1) {
+		if (h.binary)
+			fseek(f, h.skip1, SEEK_CUR);
 		else
-			for (int i = 0; i < skip1; i++)
+			for (int i = 0; i < h.skip1; i++)
 				fscanf(f, "%s", buf);
 	}
-	if (binary) {
-		if (!read_verts_bin(f, mesh, need_swap, nverts, vert_len,
-				    vert_pos, vert_norm, vert_color,
-				    float_color, vert_conf))
+	if (h.binary) {
+		if (!read_verts_bin(f, mesh, need_swap, h.nverts, h.vert_len,
+				    h.vert_pos, h.vert_norm, h.vert_color,
+				    h.float_color, h.vert_conf))
 			return false;
 	} else {
-		if (!read_verts_asc(f, mesh, nverts, vert_len,
-				    vert_pos, vert_norm, vert_color,
-				    float_color, vert_conf))
+		if (!read_verts_asc(f, mesh, h.nverts, h.vert_len,
+				    h.vert_pos, h.vert_norm, h.vert_color,
+				    h.float_color, h.vert_conf))
 			return false;
 	}
 
-	if (skip2) {
-		if (binary)
-			fseek(f, skip2, SEEK_CUR);
+	if (h.skip2) {
+		if (h.binary)
+			fseek(f, h.skip2, SEEK_CUR);
 		else
-			for (int i = 0; i < skip2; i++)
+			for (int i = 0; i < h.skip2; i++)
 				fscanf(f, "%s", buf);
 	}
 
-	if (ngrid) {
-		if (binary) {
+	if (h.ngrid) {
+		if (h.binary) {
 			if (!read_grid_bin(f, mesh, need_swap))
 				return false;
 		} else {
 			if (!read_grid_asc(f, mesh))
 				return false;
 		}
-	} else if (nstrips) {
-		if (binary) {
+	} else if (h.nstrips) {
+		if (h.binary) {
 			if (!read_strips_bin(f, mesh, need_swap))
 				return false;
 		} else {
@@ -502,14 +859,14 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 				return false;
 		}
 		mesh->convert_strips(TriMesh::TSTRIP_LENGTH);
-	} else if (nfaces) {
-		if (binary) {
-			if (!read_faces_bin(f, mesh, need_swap, nfaces,
-					    face_len, face_count, face_idx))
+	} else if (h.nfaces) {
+		if (h.binary) {
+			if (!read_faces_bin(f, mesh, need_swap, h.nfaces,
+					    h.face_len, h.face_count, h.face_idx))
 				return false;
 		} else {
-			if (!read_faces_asc(f, mesh, nfaces,
-					    face_len, face_count, face_idx))
+			if (!read_faces_asc(f, mesh, h.nfaces,
+					    h.face_len, h.face_count, h.face_idx))
 				return false;
 		}
 	}
@@ -864,7 +1221,6 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 {
 	const int vert_size = 12;
 	const int norm_size = 12;
-	const int color_size = float_color ? 12 : 3;
 	const int conf_size = 4;
 
 	if (nverts <= 0 || vert_len < 12 || vert_pos < 0)
@@ -884,70 +1240,51 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 	if (have_conf)
 		mesh->confidences.resize(new_nverts);
 
-	unsigned char *buf = new unsigned char[vert_len];
-	COND_READ(true, buf[0], vert_len);
-
-	int i = old_nverts;
-	memcpy(&mesh->vertices[i][0], &buf[vert_pos], vert_size);
-	if (have_norm)
-		memcpy(&mesh->normals[i][0], &buf[vert_norm], norm_size);
-	if (have_color && float_color)
-		memcpy(&mesh->colors[i][0], &buf[vert_color], color_size);
-	if (have_color && !float_color)
-		mesh->colors[i] = Color(&buf[vert_color]);
-	if (have_conf)
-		memcpy(&mesh->confidences[i], &buf[vert_conf], conf_size);
+	TriMesh::dprintf("\n  Reading %d vertices... ", nverts);
 
-	check_need_swap(mesh->vertices[i], need_swap);
-	if (need_swap) {
-		swap_float(mesh->vertices[i][0]);
-		swap_float(mesh->vertices[i][1]);
-		swap_float(mesh->vertices[i][2]);
-		if (have_norm) {
-			swap_float(mesh->normals[i][0]);
-			swap_float(mesh->normals[i][1]);
-			swap_float(mesh->normals[i][2]);
-		}
-		if (have_color && float_color) {
-			swap_float(mesh->colors[i][0]);
-			swap_float(mesh->colors[i][1]);
-			swap_float(mesh->colors[i][2]);
+	// Read a block of records at a time, and pull each property out of
+	// the block in one strided pass.  Bare positions are read straight
+	// into place.
+	bool slurp = (vert_len == 12 && sizeof(point) == 12);
+	int block = max(1, READ_BLOCK_BYTES / vert_len);
+	vector<unsigned char> buf;
+	if (!slurp)
+		buf.resize((size_t) min(block, nverts) * vert_len);
+
+	for (int start = 0; start < nverts; start += block) {
+		int n = min(block, nverts - start);
+		int i = old_nverts + start;
+		if (slurp) {
+			COND_READ(true, mesh->vertices[i][0], 12 * n);
+		} else {
+			COND_READ(true, buf[0], (size_t) vert_len * n);
+			gather_field<vert_size>(&mesh->vertices[i][0], &buf[0],
+						n, vert_len, vert_pos);
+			if (have_norm)
+				gather_field<norm_size>(&mesh->normals[i][0],
+					&buf[0], n, vert_len, vert_norm);
+			if (have_color && float_color)
+				gather_field<12>(&mesh->colors[i][0],
+					&buf[0], n, vert_len, vert_color);
+			if (have_color && !float_color)
+				for (int j = 0; j < n; j++)
+					mesh->colors[i+j] = Color(&buf[(size_t) j *
+						vert_len + vert_color]);
+			if (have_conf)
+				gather_field<conf_size>(&mesh->confidences[i],
+					&buf[0], n, vert_len, vert_conf);
 		}
-		if (have_conf)
-			swap_float(mesh->confidences[i]);
-	}
-
-	TriMesh::dprintf("\n  Reading %d vertices... ", nverts);
-	if (vert_len == 12 && sizeof(point) == 12 && nverts > 1)
-		return slurp_verts_bin(f, mesh, need_swap, nverts);
-	while (++i < new_nverts) {
-		COND_READ(true, buf[0], vert_len);
-		memcpy(&mesh->vertices[i][0], &buf[vert_pos], vert_size);
-		if (have_norm)
-			memcpy(&mesh->normals[i][0], &buf[vert_norm], norm_size);
-		if (have_color && float_color)
-			memcpy(&mesh->colors[i][0], &buf[vert_color], color_size);
-		if (have_color && !float_color)
-			mesh->colors[i] = Color(&buf[vert_color]);
-		if (have_conf)
-			memcpy(&mesh->confidences[i], &buf[vert_conf], conf_size);
 
+		if (start == 0)
+			check_need_swap(mesh->vertices[i], need_swap);
 		if (need_swap) {
-			swap_float(mesh->vertices[i][0]);
-			swap_float(mesh->vertices[i][1]);
-			swap_float(mesh->vertices[i][2]);
-			if (have_norm) {
-				swap_float(mesh->normals[i][0]);
-				swap_float(mesh->normals[i][1]);
-				swap_float(mesh->normals[i][2]);
-			}
-			if (have_color && float_color) {
-				swap_float(mesh->colors[i][0]);
-				swap_float(mesh->colors[i][1]);
-				swap_float(mesh->colors[i][2]);
-			}
+			swap_4byte_array(&mesh->vertices[i][0], 3 * n);
+			if (have_norm)
+				swap_4byte_array(&mesh->normals[i][0], 3 * n);
+			if (have_color && float_color)
+				swap_4byte_array(&mesh->colors[i][0], 3 * n);
 			if (have_conf)
-				swap_float(mesh->confidences[i]);
+				swap_4byte_array(&mesh->confidences[i], n);
 		}
 	}
 
@@ -955,22 +1292,6 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 }
 
 
-// Optimized reader for the simple case of just vertices w/o other properties
-static bool slurp_verts_bin(FILE *f, TriMesh *mesh, bool need_swap, int nverts)
-{
-	int first = mesh->vertices.size() - nverts + 1;
-	COND_READ(true, mesh->vertices[first][0], (nverts-1)*12);
-	if (need_swap) {
-	    for (int i = first; i < mesh->vertices.size(); i++) {
-			swap_float(mesh->vertices[i][0]);
-			swap_float(mesh->vertices[i][1]);
-			swap_float(mesh->vertices[i][2]);
-		}
-	}
-	return true;
-}
-
-
 // Read a bunch of vertices from an ASCII file.
 // Parameters are as in read_verts_bin, but offsets are in
 // (white-space-separated) words, rather than in bytes
@@ -1064,32 +1385,53 @@ static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 
 	// face_len doesn't include the indices themeselves, since that's
 	// potentially variable-length
-	int face_skip = face_len - face_idx;
-
-	vector<unsigned char> buf(max(face_idx, face_skip));
+	// Records are parsed out of a buffer that is refilled a block at a
+	// time.  A block never goes past the shortest the remaining faces
+	// could be (triangles, or no indices at all if each face has a
+	// count), so nothing after the faces is read and there's no need to
+	// seek back, which pipes can't do.  Longer faces just cause more
+	// refills.
+	size_t min_len = (face_count >= 0) ? face_len : face_len + 12;
+	vector<unsigned char> buf;
+	size_t pos = 0, end = 0;
 	vector<int> thisface;
 	for (int i = 0; i < nfaces; i++) {
-		COND_READ(face_idx > 0, buf[0], face_idx);
+		size_t want = min((size_t) READ_BLOCK_BYTES,
+				  (size_t) (nfaces - i) * min_len);
+		if (!fill_buf(f, buf, pos, end, face_idx, want))
+			return false;
 
 		unsigned this_ninds = 3;
 		if (face_count >= 0) {
 			// Read count - either 1 or 4 bytes
 			if (face_idx - face_count == 4) {
-				this_ninds = * (unsigned *) &(buf[face_count]);
+				memcpy(&this_ninds, &buf[pos + face_count], 4);
 				if (need_swap)
 					swap_unsigned(this_ninds);
 			} else {
-				this_ninds = buf[face_count];
+				this_ninds = buf[pos + face_count];
 			}
 		}
-		thisface.resize(this_ninds);
-		COND_READ(true, thisface[0], 4*this_ninds);
-		if (need_swap) {
-			for (size_t j = 0; j < thisface.size(); j++)
-				swap_int(thisface[j]);
+		size_t rec_len = face_len + 4 * (size_t) this_ninds;
+		if (!fill_buf(f, buf, pos, end, rec_len, want))
+			return false;
+
+		const unsigned char *inds = &buf[pos + face_idx];
+		if (this_ninds == 3) {
+			int v[3];
+			memcpy(v, inds, 12);
+			if (need_swap)
+				swap_4byte_array(v, 3);
+			mesh->faces.push_back(Face(v[0], v[1], v[2]));
+		} else {
+			thisface.resize(this_ninds);
+			if (this_ninds)
+				memcpy(&thisface[0], inds, 4 * this_ninds);
+			if (need_swap && this_ninds)
+				swap_4byte_array(&thisface[0], this_ninds);
+			tess(mesh->vertices, thisface, mesh->faces);
 		}
-		tess(mesh->vertices, thisface, mesh->faces);
-		COND_READ(face_skip > 0, buf[0], face_skip);
+		pos += rec_len;
 	}
 
 	return true;
@@ -1307,42 +1649,6 @@ static void check_need_swap(const point &p, bool &need_swap)
 }
 
 
-// Check whether the indices in the file mistakenly go
-// from 1..N instead of 0..N-1
-static void check_ind_range(TriMesh *mesh)
-{
-	if (mesh->faces.empty())
-		return;
-	int min_ind = mesh->faces[0][0];
-	int max_ind = mesh->faces[0][0];
-	for (int i = 0; i < mesh->faces.size(); i++) {
-		for (int j = 0; j < 3; j++) {
-			min_ind = min(min_ind, mesh->faces[i][j]);
-			max_ind = max(max_ind, mesh->faces[i][j]);
-		}
-	}
-
-	int nv = mesh->vertices.size();
-
-	// All good
-	if (min_ind == 0 && max_ind == nv-1)
-		return;
-
-	// Simple fix: offset everything
-	if (max_ind - min_ind == nv-1) {
-		TriMesh::dprintf("Found indices ranging from %d through %d\n",
-				 min_ind, max_ind);
-		TriMesh::dprintf("Remapping to %d through %d\n", 0, nv-1);
-		for (int i = 0; i < mesh->faces.size(); i++)
-			for (int j = 0; j < 3; j++)
-				mesh->faces[i][j] -= min_ind;
-		return;
-	}
-
-	// Else can't do anything...
-}
-
-
 // Skip comments in an ASCII file (lines beginning with #)
 static void skip_comments(FILE *f)
 {
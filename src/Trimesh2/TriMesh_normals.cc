@@ -40,80 +40,69 @@ public:
 };
 
 
-// Compute per-vertex normals
-// TODO Uncomment first lines after rotate functions also rotate normals
+// Compute per-vertex normals.  Normals that were overwritten in place
+// (e.g., by diffuse_normals) are not live, and get recomputed.
 void TriMesh::need_normals()
 {
-	//if (normals.size() == vertices.size())
-		//return;
+	if (cache_live(CACHE_NORMALS))
+		return;
 
 	need_faces();
 	int nf = faces.size(), nv = vertices.size();
 
+	// Normals of a mesh come out of the fused per-face pass, along
+	// with the face normals, areas, and centers
+	if (nf != 0) {
+		need_geometry(GEOM_NORMALS);
+		return;
+	}
+
 	dprintf("Computing normals... ");
 	normals.clear();
 	normals.resize(nv);
 
-	if (nf != 0) {
-		// Find normals of a mesh
-#pragma omp parallel for
-		for (int i = 0; i < nf; i++) {
-			const point &p0 = vertices[faces[i][0]];
-			const point &p1 = vertices[faces[i][1]];
-			const point &p2 = vertices[faces[i][2]];
-			vec a = p0-p1, b = p1-p2, c = p2-p0;
-			float l2a = len2(a), l2b = len2(b), l2c = len2(c);
-			vec bias(1e-37f, 1e-37f, 1e-37f);
-			faces[i].facenormal = (a CROSS b) + bias;
-			faces[i].faceArea = .5f * len( faces[i].facenormal );
-			normals[faces[i][0]] += faces[i].facenormal * (1.0f / (l2a * l2c + 1e-27f));
-			normals[faces[i][1]] += faces[i].facenormal * (1.0f / (l2b * l2a + 1e-27f));
-			normals[faces[i][2]] += faces[i].facenormal * (1.0f / (l2c * l2b + 1e-27f));
-			faces[i].faceCenter = (p0+p1+p2)/3.0f;
+	// Find normals of a point cloud
+	const int k = 12;
+	const vec ref(0, 0, 1);
+	const float *v0 = &vertices[0][0];
+	KDtree *kd = new KDtree(v0, nv);
+	for (int i = 0; i < nv; i++) {
+		const float *vi = &vertices[i][0];
+		set<int> s;
+		s.insert(vi - v0);
+		for (int j = 0; j < k; j++) {
+			NotInSet ns(v0, s);
+			const float *match =
+				kd->closest_to_pt(vi, 0.0f, &ns);
+			if (!match)
+				break;
+			s.insert(match - v0);
+		}
+		if (s.size() < 4) {
+			printf("Warning: not enough points for vertex %d\n", i);
+			normals[i] = ref;
+			continue;
 		}
-	} else {
-		// Find normals of a point cloud
-		const int k = 12;
-		const vec ref(0, 0, 1);
-		const float *v0 = &vertices[0][0];
-		KDtree *kd = new KDtree(v0, nv);
-		for (int i = 0; i < nv; i++) {
-			const float *vi = &vertices[i][0];
-			set<int> s;
-			s.insert(vi - v0);
-			for (int j = 0; j < k; j++) {
-				NotInSet ns(v0, s);
-				const float *match =
-					kd->closest_to_pt(vi, 0.0f, &ns);
-				if (!match)
-					break;
-				s.insert(match - v0);
-			}
-			if (s.size() < 4) {
-				printf("Warning: not enough points for vertex %d\n", i);
-				normals[i] = ref;
+		// Compute covariance
+		float C[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
+		for (set<int>::iterator it = s.begin(); it != s.end(); it++) {
+			int ind = *it / 3;
+			if (ind == i)
 				continue;
-			}
-			// Compute covariance
-			float C[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
-			for (set<int>::iterator it = s.begin(); it != s.end(); it++) {
-				int ind = *it / 3;
-				if (ind == i)
-					continue;
-				vec d = vertices[ind] - vertices[i];
-				for (int l = 0; l < 3; l++)
-					for (int m = 0; m < 3; m++)
-						C[l][m] += d[l] * d[m];
-			}
-			float e[3];
-			eigdc<float,3>(C, e);
-			normals[i] = vec(C[0][0], C[1][0], C[2][0]);
-			if ((normals[i] DOT ref) < 0.0f)
-				normals[i] = -normals[i];
+			vec d = vertices[ind] - vertices[i];
+			for (int l = 0; l < 3; l++)
+				for (int m = 0; m < 3; m++)
+					C[l][m] += d[l] * d[m];
 		}
-		delete kd;
+		float e[3];
+		eigdc<float,3>(C, e);
+		normals[i] = vec(C[0][0], C[1][0], C[2][0]);
+		if ((normals[i] DOT ref) < 0.0f)
+			normals[i] = -normals[i];
 	}
+	delete kd;
 
+	cache_stamp(CACHE_NORMALS);
 	dprintf("Done.\n");
 }
 
@@ -0,0 +1,269 @@
+/*
+TriMesh_stream.cc
+Chunk-at-a-time handlers for streamed meshes: transforms, bounding boxes,
+trimming, and writing the result back out.  The readers themselves are
+in TriMesh_io.cc.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "TriMesh_stream.h"
+using namespace std;
+
+
+// Transform the vertices and normals
+bool MeshStreamXform::vertices(MeshVertexChunk &chunk)
+{
+	int n = chunk.size();
+	for (int i = 0; i < n; i++)
+		chunk.vertices[i] = xf * chunk.vertices[i];
+	if (!chunk.normals.empty()) {
+		xform nxf = norm_xf(xf);
+		for (int i = 0; i < n; i++) {
+			chunk.normals[i] = nxf * chunk.normals[i];
+			normalize(chunk.normals[i]);
+		}
+	}
+	return MeshStreamFilter::vertices(chunk);
+}
+
+
+// Grow the bounding box
+bool MeshStreamBBox::vertices(MeshVertexChunk &chunk)
+{
+	int n = chunk.size();
+	for (int i = 0; i < n; i++) {
+		const point &p = chunk.vertices[i];
+		if (!bbox.valid) {
+			bbox.min = bbox.max = p;
+			bbox.valid = true;
+			continue;
+		}
+		for (int j = 0; j < 3; j++) {
+			if (p[j] < bbox.min[j])  bbox.min[j] = p[j];
+			if (p[j] > bbox.max[j])  bbox.max[j] = p[j];
+		}
+	}
+	return MeshStreamFilter::vertices(chunk);
+}
+
+
+// Note which vertices are below the cutoff
+bool MeshStreamYCutoff::vertices(MeshVertexChunk &chunk)
+{
+	int n = chunk.size();
+	if ((int) below.size() < chunk.first + n)
+		below.resize(chunk.first + n);
+	for (int i = 0; i < n; i++)
+		below[chunk.first + i] = (chunk.vertices[i][1] < y);
+	return MeshStreamFilter::vertices(chunk);
+}
+
+
+// Drop the faces that touch them
+bool MeshStreamYCutoff::faces(MeshFaceChunk &chunk)
+{
+	int n = chunk.size(), nbelow = below.size(), nkept = 0;
+	for (int i = 0; i < n; i++) {
+		const int *f = &chunk.inds[3*i];
+		bool drop = false;
+		for (int j = 0; j < 3; j++)
+			if (f[j] >= 0 && f[j] < nbelow && below[f[j]])
+				drop = true;
+		if (drop)
+			continue;
+		for (int j = 0; j < 3; j++)
+			chunk.inds[3*nkept+j] = f[j];
+		nkept++;
+	}
+	if (!nkept)
+		return true;
+	chunk.inds.resize(3 * nkept);
+	chunk.first = nfaces_out;
+	nfaces_out += nkept;
+	return MeshStreamFilter::faces(chunk);
+}
+
+
+// Make room for everything, if we know how much is coming
+bool MeshStreamToMesh::begin(int nverts, int nfaces)
+{
+	if (nverts > 0)
+		mesh->vertices.reserve(mesh->vertices.size() + nverts);
+	if (nfaces > 0)
+		mesh->faces.reserve(mesh->faces.size() + nfaces);
+	return true;
+}
+
+
+// Append vertices and whichever properties came with them.  Colors can
+// start partway through an obj file; the vertices before them get black.
+bool MeshStreamToMesh::vertices(MeshVertexChunk &chunk)
+{
+	if (!chunk.colors.empty())
+		mesh->colors.resize(mesh->vertices.size(), Color(0,0,0));
+	mesh->vertices.insert(mesh->vertices.end(),
+		chunk.vertices.begin(), chunk.vertices.end());
+	mesh->normals.insert(mesh->normals.end(),
+		chunk.normals.begin(), chunk.normals.end());
+	mesh->colors.insert(mesh->colors.end(),
+		chunk.colors.begin(), chunk.colors.end());
+	mesh->confidences.insert(mesh->confidences.end(),
+		chunk.confidences.begin(), chunk.confidences.end());
+	return true;
+}
+
+
+// Append faces
+bool MeshStreamToMesh::faces(MeshFaceChunk &chunk)
+{
+	int n = chunk.size();
+	for (int i = 0; i < n; i++)
+		mesh->faces.push_back(Face(chunk.inds[3*i],
+			chunk.inds[3*i+1], chunk.inds[3*i+2]));
+	return true;
+}
+
+
+// Anything computed from the old contents is out of date
+bool MeshStreamToMesh::end()
+{
+	mesh->vertices_changed();
+	mesh->faces_changed();
+	return true;
+}
+
+
+static inline unsigned char color2uchar(float p)
+{
+	return min(max(int(255.0f * p + 0.5f), 0), 255);
+}
+
+
+MeshStreamPlyWriter::MeshStreamPlyWriter(const char *filename_) :
+	f(NULL), ftmp(NULL), nverts_pos(0), nfaces_pos(0),
+	nverts(0), nfaces(0), write_norm(false), write_color(false)
+{
+	strncpy(filename, filename_, sizeof(filename) - 1);
+	filename[sizeof(filename) - 1] = '\0';
+}
+
+
+MeshStreamPlyWriter::~MeshStreamPlyWriter()
+{
+	if (f)
+		fclose(f);
+	if (ftmp)
+		fclose(ftmp);
+}
+
+
+// Start the file, with the properties of the first chunk of vertices and
+// room for the counts to be filled in later
+bool MeshStreamPlyWriter::write_header(const MeshVertexChunk *chunk)
+{
+	f = fopen(filename, "wb");
+	ftmp = tmpfile();
+	if (!f || !ftmp) {
+		perror("MeshStreamPlyWriter");
+		return false;
+	}
+	write_norm = chunk && !chunk->normals.empty();
+	write_color = chunk && !chunk->colors.empty();
+
+	int one = 1;
+	bool little_endian = (*(char *) &one == 1);
+	fprintf(f, "ply\nformat binary_%s_endian 1.0\n",
+		little_endian ? "little" : "big");
+	nverts_pos = ftell(f);
+	fprintf(f, "element vertex %10d\n", 0);
+	fprintf(f, "property float x\nproperty float y\nproperty float z\n");
+	if (write_norm)
+		fprintf(f, "property float nx\nproperty float ny\nproperty float nz\n");
+	if (write_color)
+		fprintf(f, "property uchar diffuse_red\n"
+			   "property uchar diffuse_green\n"
+			   "property uchar diffuse_blue\n");
+	nfaces_pos = ftell(f);
+	fprintf(f, "element face %10d\n", 0);
+	fprintf(f, "property list uchar int vertex_indices\nend_header\n");
+	return true;
+}
+
+
+// Vertices go straight out
+bool MeshStreamPlyWriter::vertices(MeshVertexChunk &chunk)
+{
+	if (!f && !write_header(&chunk))
+		return false;
+
+	int n = chunk.size();
+	bool have_norm = write_norm && (int) chunk.normals.size() == n;
+	bool have_color = write_color && (int) chunk.colors.size() == n;
+	size_t rec_len = 12 + (write_norm ? 12 : 0) + (write_color ? 3 : 0);
+	buf.resize(n * rec_len);
+	unsigned char *p = buf.empty() ? NULL : &buf[0];
+	for (int i = 0; i < n; i++) {
+		memcpy(p, &chunk.vertices[i][0], 12);
+		p += 12;
+		if (write_norm) {
+			vec nrm = have_norm ? chunk.normals[i] : vec();
+			memcpy(p, &nrm[0], 12);
+			p += 12;
+		}
+		if (write_color) {
+			for (int j = 0; j < 3; j++)
+				*p++ = have_color ?
+					color2uchar(chunk.colors[i][j]) : 0;
+		}
+	}
+	if (n && fwrite(&buf[0], rec_len, n, f) != (size_t) n)
+		return false;
+	nverts += n;
+	return true;
+}
+
+
+// Faces wait in the temporary file
+bool MeshStreamPlyWriter::faces(MeshFaceChunk &chunk)
+{
+	if (!f && !write_header(NULL))
+		return false;
+
+	int n = chunk.size();
+	buf.resize(13 * n);
+	for (int i = 0; i < n; i++) {
+		buf[13*i] = 3;
+		memcpy(&buf[13*i+1], &chunk.inds[3*i], 12);
+	}
+	if (n && fwrite(&buf[0], 13, n, ftmp) != (size_t) n)
+		return false;
+	nfaces += n;
+	return true;
+}
+
+
+// Copy the faces over and fill in the counts
+bool MeshStreamPlyWriter::end()
+{
+	if (!f && !write_header(NULL))
+		return false;
+
+	rewind(ftmp);
+	buf.resize(1 << 20);
+	size_t n;
+	while ((n = fread(&buf[0], 1, buf.size(), ftmp)) > 0)
+		if (fwrite(&buf[0], 1, n, f) != n)
+			return false;
+	fclose(ftmp);
+	ftmp = NULL;
+
+	fseek(f, nverts_pos, SEEK_SET);
+	fprintf(f, "element vertex %10d\n", nverts);
+	fseek(f, nfaces_pos, SEEK_SET);
+	fprintf(f, "element face %10d\n", nfaces);
+	bool ok = !ferror(f);
+	fclose(f);
+	f = NULL;
+	return ok;
+}
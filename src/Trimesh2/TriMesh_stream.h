@@ -0,0 +1,159 @@
+#ifndef TRIMESH_STREAM_H
+#define TRIMESH_STREAM_H
+/*
+TriMesh_stream.h
+Streaming access to meshes that are too big to load.  The file is read a
+chunk at a time, and each chunk is handed to a MeshStreamHandler; at most
+one chunk of vertices and one of faces is in memory at once.
+
+Vertices always arrive before any face that uses them.  Faces are
+triangles, given as 3 vertex indices each.
+
+Handlers can be chained: the MeshStream* filters below work on each chunk
+in place and pass it along to the next handler.
+*/
+
+#include "TriMesh.h"
+#include "XForm.h"
+#include <stdio.h>
+
+
+// Default number of vertices or faces per chunk
+#define MESH_STREAM_CHUNK 65536
+
+
+// A run of consecutive vertices, starting with vertex number first.
+// Properties that are not in the file are empty; the rest have one entry
+// per vertex.
+struct MeshVertexChunk {
+	int first;
+	vector<point> vertices;
+	vector<vec> normals;
+	vector<Color> colors;
+	vector<float> confidences;
+	int size() const { return vertices.size(); }
+};
+
+
+// A run of consecutive triangles, starting with face number first
+struct MeshFaceChunk {
+	int first;
+	vector<int> inds;	// 3 per face
+	int size() const { return inds.size() / 3; }
+};
+
+
+// Receives the contents of a mesh.  Returning false from any of these
+// stops the read.
+class MeshStreamHandler {
+public:
+	// Counts are as given in the file header, or -1 if not known
+	virtual bool begin(int /* nverts */, int /* nfaces */)
+		{ return true; }
+	virtual bool vertices(MeshVertexChunk &/* chunk */)
+		{ return true; }
+	virtual bool faces(MeshFaceChunk &/* chunk */)
+		{ return true; }
+	virtual bool end()
+		{ return true; }
+	virtual ~MeshStreamHandler()
+		{}
+};
+
+
+// Read a mesh (ply, obj, or off) through a handler, chunk_size vertices
+// or faces at a time.  Filename can be "-" for stdin.
+extern bool read_stream(const char *filename, MeshStreamHandler &handler,
+			int chunk_size = MESH_STREAM_CHUNK);
+
+
+// A handler that passes everything along to another one
+class MeshStreamFilter : public MeshStreamHandler {
+public:
+	MeshStreamHandler *next;
+	MeshStreamFilter(MeshStreamHandler *next_ = NULL) : next(next_)
+		{}
+	virtual bool begin(int nverts, int nfaces)
+		{ return !next || next->begin(nverts, nfaces); }
+	virtual bool vertices(MeshVertexChunk &chunk)
+		{ return !next || next->vertices(chunk); }
+	virtual bool faces(MeshFaceChunk &chunk)
+		{ return !next || next->faces(chunk); }
+	virtual bool end()
+		{ return !next || next->end(); }
+};
+
+
+// Transform the vertices (and normals) by xf, as apply_xform does
+class MeshStreamXform : public MeshStreamFilter {
+public:
+	xform xf;
+	MeshStreamXform(const xform &xf_, MeshStreamHandler *next_ = NULL) :
+		MeshStreamFilter(next_), xf(xf_)
+		{}
+	virtual bool vertices(MeshVertexChunk &chunk);
+};
+
+
+// Accumulate the bounding box of the vertices
+class MeshStreamBBox : public MeshStreamFilter {
+public:
+	TriMesh::BBox bbox;
+	MeshStreamBBox(MeshStreamHandler *next_ = NULL) :
+		MeshStreamFilter(next_)
+		{}
+	virtual bool vertices(MeshVertexChunk &chunk);
+};
+
+
+// Drop faces with any vertex below the given y.  Vertices are passed
+// along untouched so that indices stay valid; remembers one bit per
+// vertex.
+class MeshStreamYCutoff : public MeshStreamFilter {
+public:
+	float y;
+	vector<bool> below;
+	int nfaces_out;
+	MeshStreamYCutoff(float y_, MeshStreamHandler *next_ = NULL) :
+		MeshStreamFilter(next_), y(y_), nfaces_out(0)
+		{}
+	virtual bool vertices(MeshVertexChunk &chunk);
+	virtual bool faces(MeshFaceChunk &chunk);
+};
+
+
+// Collect everything into a TriMesh, for streams that do fit in memory
+class MeshStreamToMesh : public MeshStreamHandler {
+public:
+	TriMesh *mesh;
+	MeshStreamToMesh(TriMesh *mesh_) : mesh(mesh_)
+		{}
+	virtual bool begin(int nverts, int nfaces);
+	virtual bool vertices(MeshVertexChunk &chunk);
+	virtual bool faces(MeshFaceChunk &chunk);
+	virtual bool end();
+};
+
+
+// Write a binary ply file with vertices (plus normals and colors, if the
+// first chunk has them) and faces.  Vertices go straight to the file, and
+// faces are spooled to a temporary file until all the vertices are in;
+// the counts in the header are filled in at the end.
+class MeshStreamPlyWriter : public MeshStreamHandler {
+public:
+	MeshStreamPlyWriter(const char *filename_);
+	virtual ~MeshStreamPlyWriter();
+	virtual bool vertices(MeshVertexChunk &chunk);
+	virtual bool faces(MeshFaceChunk &chunk);
+	virtual bool end();
+private:
+	char filename[1024];
+	FILE *f, *ftmp;
+	long nverts_pos, nfaces_pos;
+	int nverts, nfaces;
+	bool write_norm, write_color;
+	vector<unsigned char> buf;
+	bool write_header(const MeshVertexChunk *chunk);
+};
+
+#endif
@@ -7,70 +7,233 @@ Code for dealing with triangle strips
 */
 
 #include "TriMesh.h"
+#include "timestamp.h"
+#include <algorithm>
+using namespace std;
+
+
+// Faces per region stripped independently (and in parallel)
+#define TSTRIP_REGION_FACES 16384
+
+// Bins in the histogram used to cut the mesh into regions
+#define TSTRIP_NBINS 4096
 
 
 // Forward declarations
-static void tstrip_build(TriMesh &mesh, int f, vector<signed char> &face_avail,
-			 vector<int> &todo);
+static void find_strip_adjacency(const TriMesh &mesh, const vector<int> &region,
+				 vector<int> &adj);
+static void tstrip_build(const TriMesh &mesh, const vector<int> &adj, int f,
+			 vector<signed char> &face_avail, vector<int> &todo,
+			 vector<int> &strips);
 static void collect_tris_in_strips(vector<int> &tstrips);
 
 
+// Cut the mesh into slabs along the longest axis of the bounding box,
+// with about TSTRIP_REGION_FACES faces each.  Returns the number of
+// regions, the region of each face, and the faces of each region in
+// compressed-row form.
+static int find_strip_regions(TriMesh &mesh, vector<int> &region,
+	vector<int> &rstart, vector<int> &rfaces)
+{
+	int nf = mesh.faces.size();
+	int nregions = max(1, (nf + TSTRIP_REGION_FACES - 1) / TSTRIP_REGION_FACES);
+	region.assign(nf, 0);
+	if (nregions > 1) {
+		mesh.need_bbox();
+		vec size = mesh.bbox.size();
+		int axis = (size[0] > size[1]) ?
+			(size[0] > size[2] ? 0 : 2) : (size[1] > size[2] ? 1 : 2);
+		float lo = mesh.bbox.min[axis];
+		float scale = (size[axis] > 0.0f) ?
+			TSTRIP_NBINS / size[axis] : 0.0f;
+
+		// Histogram of the lowest vertex of each face, then give each
+		// run of bins with about the same number of faces its own
+		// region.  (Going by the lowest vertex rather than the
+		// centroid keeps rows of a grid aligned with the axis from
+		// being split down the middle.)
+		vector<int> bin(nf), count(TSTRIP_NBINS);
+		for (int i = 0; i < nf; i++) {
+			const Face &f = mesh.faces[i];
+			float x = min(min(mesh.vertices[f[0]][axis],
+					  mesh.vertices[f[1]][axis]),
+					  mesh.vertices[f[2]][axis]) - lo;
+			bin[i] = min(max(int(x * scale), 0), TSTRIP_NBINS - 1);
+			count[bin[i]]++;
+		}
+		vector<int> bin_region(TSTRIP_NBINS);
+		long long before = 0;
+		for (int b = 0; b < TSTRIP_NBINS; b++) {
+			bin_region[b] = int(before * nregions / nf);
+			before += count[b];
+		}
+		for (int i = 0; i < nf; i++)
+			region[i] = bin_region[bin[i]];
+	}
+
+	rstart.assign(nregions + 1, 0);
+	for (int i = 0; i < nf; i++)
+		rstart[region[i] + 1]++;
+	for (int r = 0; r < nregions; r++)
+		rstart[r + 1] += rstart[r];
+	rfaces.resize(nf);
+	vector<int> next(rstart.begin(), rstart.end() - 1);
+	for (int i = 0; i < nf; i++)
+		rfaces[next[region[i]]++] = i;
+	return nregions;
+}
+
+
 // Convert faces to tstrips
 void TriMesh::need_tstrips()
 {
 	if (faces.empty() || !tstrips.empty())
 		return;
 
-	need_across_edge();
-
 	dprintf("Building triangle strips... ");
+	timestamp t = now();
 	int nf = faces.size();
 
-	vector<int> todo;
+	vector<int> region, rstart, rfaces, adj;
+	int nregions = find_strip_regions(*this, region, rstart, rfaces);
+	find_strip_adjacency(*this, region, adj);
+
 	vector<signed char> face_avail(nf);
-	for (int i = 0; i < nf; i++) {
-		face_avail[i] = (across_edge[i][0] != -1) +
-				(across_edge[i][1] != -1) +
-				(across_edge[i][2] != -1);
-		if (face_avail[i] == 1)
-			todo.push_back(i);
+	for (int i = 0; i < nf; i++)
+		face_avail[i] = (adj[3*i] != -1) +
+				(adj[3*i+1] != -1) +
+				(adj[3*i+2] != -1);
+
+	// Strips never leave a region, so each can be done on its own
+	vector< vector<int> > rstrips(nregions);
+#pragma omp parallel for schedule(dynamic)
+	for (int r = 0; r < nregions; r++) {
+		vector<int> todo;
+		vector<int> &strips = rstrips[r];
+		strips.reserve(2 * (rstart[r+1] - rstart[r]));
+		for (int k = rstart[r]; k < rstart[r+1]; k++)
+			if (face_avail[rfaces[k]] == 1)
+				todo.push_back(rfaces[k]);
+
+		int k = rstart[r];
+		while (k < rstart[r+1]) {
+			int next;
+			if (todo.empty()) {
+				next = rfaces[k++];
+			} else {
+				next = todo.back();
+				todo.pop_back();
+			}
+			if (face_avail[next] < 0)
+				continue;
+			tstrip_build(*this, adj, next, face_avail, todo, strips);
+		}
 	}
 
-	tstrips.reserve(faces.size() * 2);
+	size_t total = 0;
+	for (int r = 0; r < nregions; r++)
+		total += rstrips[r].size();
+	tstrips.reserve(total);
+	for (int r = 0; r < nregions; r++) {
+		tstrips.insert(tstrips.end(), rstrips[r].begin(), rstrips[r].end());
+		vector<int>().swap(rstrips[r]);
+	}
 
-	int nstrips = 0;
-	int i = 0;
-	while (i < faces.size()) {
-		int next;
-		if (todo.empty()) {
-			next = i++;
-		} else {
-			next = todo.back();
-			todo.pop_back();
-		}
-		if (face_avail[next] < 0)
+	// Strip-length statistics
+	int nstrips = 0, nsingle = 0, maxlen = 0, len = 0;
+	for (size_t i = 0; i < tstrips.size(); i++) {
+		if (tstrips[i] != -1) {
+			len++;
 			continue;
-		tstrip_build(*this, next, face_avail, todo);
+		}
 		nstrips++;
+		if (len == 3)
+			nsingle++;
+		maxlen = max(maxlen, len - 2);
+		len = 0;
 	}
 
 	convert_strips(TSTRIP_LENGTH);
 
-	dprintf("Done.\n  %d strips (Avg. length %.1f)\n",
-		nstrips, (float) faces.size() / nstrips);
+	dprintf("Done.  %.2f msec.\n", (now() - t) * 1000.0f);
+	dprintf("  %d strips in %d regions (Avg. length %.1f, max %d, "
+		"%d single triangles)\n  %.2f vertices per triangle\n",
+		nstrips, nregions, (float) nf / nstrips, maxlen, nsingle,
+		(float) (tstrips.size() - nstrips) / nf);
+}
+
+
+// For each face, the face across each edge (opposite each vertex, as in
+// across_edge), or -1 on boundaries and between regions.  Works from a
+// flat map of half-edges out of each vertex, so no other connectivity
+// or geometry is needed.  Faces are only paired if their orientations
+// agree, and each half-edge is paired with the first opposite half-edge
+// only if that one picks it in turn, so non-manifold edges stay
+// consistent.
+static void find_strip_adjacency(const TriMesh &mesh, const vector<int> &region,
+	vector<int> &adj)
+{
+	int nv = mesh.vertices.size(), nf = mesh.faces.size();
+
+	// Half-edge 3*i+j of face i runs between the two vertices other
+	// than j.  Bucket them by starting vertex.
+	vector<int> estart(nv + 1);
+	for (int i = 0; i < nf; i++)
+		for (int j = 0; j < 3; j++)
+			estart[mesh.faces[i][(j+1)%3] + 1]++;
+	for (int i = 0; i < nv; i++)
+		estart[i + 1] += estart[i];
+	vector<int> edest(3 * nf), eid(3 * nf);
+	vector<int> next(estart.begin(), estart.end() - 1);
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int k = next[mesh.faces[i][(j+1)%3]]++;
+			edest[k] = mesh.faces[i][(j+2)%3];
+			eid[k] = 3 * i + j;
+		}
+	}
+
+	adj.resize(3 * nf);
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int v1 = mesh.faces[i][(j+1)%3];
+			int v2 = mesh.faces[i][(j+2)%3];
+			int h = 3 * i + j, other = -1;
+			for (int k = estart[v2]; k < estart[v2+1]; k++) {
+				if (edest[k] == v1) {
+					other = eid[k];
+					break;
+				}
+			}
+			if (other >= 0) {
+				for (int k = estart[v1]; k < estart[v1+1]; k++) {
+					if (edest[k] == v2) {
+						if (eid[k] != h)
+							other = -1;
+						break;
+					}
+				}
+			}
+			int f = (other >= 0) ? other / 3 : -1;
+			if (f == i || (f >= 0 && region[f] != region[i]))
+				f = -1;
+			adj[h] = f;
+		}
+	}
 }
 
 
 // Build a triangle strip starting with the given face
-static void tstrip_build(TriMesh &mesh, int f, vector<signed char> &face_avail,
-	vector<int> &todo)
+static void tstrip_build(const TriMesh &mesh, const vector<int> &adj, int f,
+	vector<signed char> &face_avail, vector<int> &todo, vector<int> &strips)
 {
-	Face &v = mesh.faces[f];
+	const Face &v = mesh.faces[f];
 	if (face_avail[f] == 0) {
-		mesh.tstrips.push_back(v[0]);
-		mesh.tstrips.push_back(v[1]);
-		mesh.tstrips.push_back(v[2]);
-		mesh.tstrips.push_back(-1);
+		strips.push_back(v[0]);
+		strips.push_back(v[1]);
+		strips.push_back(v[2]);
+		strips.push_back(-1);
 		face_avail[f] = -1;
 		return;
 	}
@@ -78,12 +241,12 @@ static void tstrip_build(TriMesh &mesh, int f, vector<signed char> &face_avail,
 	int score[3];
 	for (int i = 0; i < 3; i++) {
 		score[i] = 0;
-		int ae = mesh.across_edge[f][i];
+		int ae = adj[3*f+i];
 		if (ae == -1 || face_avail[ae] < 0)
 			continue;
 		score[i]++;
 		int next_edge = mesh.faces[ae].indexof(v[(i+1)%3]);
-		int nae = mesh.across_edge[ae][next_edge];
+		int nae = adj[3*ae+next_edge];
 		if (nae == -1 || face_avail[nae] < 0)
 			continue;
 		score[i]++;
@@ -99,14 +262,14 @@ static void tstrip_build(TriMesh &mesh, int f, vector<signed char> &face_avail,
 	int vlast1 = v[(best+1)%3];
 	int vnext  = v[(best+2)%3];
 	int dir = 1;
-	mesh.tstrips.push_back(vlast2);
-	mesh.tstrips.push_back(vlast1);
+	strips.push_back(vlast2);
+	strips.push_back(vlast1);
 
 	while (1) {
-		mesh.tstrips.push_back(vnext);
+		strips.push_back(vnext);
 		face_avail[f] = -1;
 		for (int j = 0; j < 3; j++) {
-			int ae = mesh.across_edge[f][j];
+			int ae = adj[3*f+j];
 			if (ae == -1)
 				continue;
 			if (face_avail[ae] > 0)
@@ -115,7 +278,7 @@ static void tstrip_build(TriMesh &mesh, int f, vector<signed char> &face_avail,
 				todo.push_back(ae);
 		}
 
-		f = mesh.across_edge[f][mesh.faces[f].indexof(vlast2)];
+		f = adj[3*f+mesh.faces[f].indexof(vlast2)];
 		if (f == -1 || face_avail[f] < 0)
 			break;
 		vlast2 = vlast1;
@@ -124,7 +287,7 @@ static void tstrip_build(TriMesh &mesh, int f, vector<signed char> &face_avail,
 		dir = -dir;
 	}
 	
-	mesh.tstrips.push_back(-1);
+	strips.push_back(-1);
 }
 
 
@@ -164,6 +327,7 @@ void TriMesh::unpack_tstrips()
 		flip = !flip;
 		len--;
 	}
+	faces_changed();
 	dprintf("Done.\n  %d triangles\n", nfaces);
 }
 
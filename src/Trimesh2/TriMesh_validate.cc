@@ -0,0 +1,238 @@
+/*
+TriMesh_validate.cc
+Sanity checks on the faces of a mesh: index ranges, degenerate and
+duplicate faces, and non-manifold edges, with optional repair.
+*/
+
+#include "TriMesh.h"
+#include <algorithm>
+using namespace std;
+
+
+// What's wrong with each face
+enum { FACE_OK, FACE_OUT_OF_RANGE, FACE_DEGENERATE, FACE_DUPLICATE };
+
+
+// Sort each row of a compressed-row table in place.  Rows are usually
+// just a handful of entries, so insertion sort does better than sort().
+template <class T>
+static void sort_rows(const vector<int> &start, vector<T> &vals)
+{
+	int nrows = start.size() - 1;
+#pragma omp parallel for schedule(dynamic, 4096)
+	for (int i = 0; i < nrows; i++) {
+		int first = start[i], last = start[i+1];
+		if (last - first > 16) {
+			sort(vals.begin() + first, vals.begin() + last);
+			continue;
+		}
+		for (int k = first + 1; k < last; k++) {
+			T val = vals[k];
+			int l = k;
+			for ( ; l > first && val < vals[l-1]; l--)
+				vals[l] = vals[l-1];
+			vals[l] = val;
+		}
+	}
+}
+
+
+// Turn per-row counts (shifted up by one) into row starts
+static void prefix_sum(vector<int> &start)
+{
+	for (size_t i = 1; i < start.size(); i++)
+		start[i] += start[i-1];
+}
+
+
+// Sort the vertices of each face into a compact array, and note which
+// faces have indices out of range or use a vertex twice
+static void classify_faces(const vector<Face> &faces, int nv,
+	vector<int> &tri, vector<signed char> &state,
+	int &out_of_range, int &degenerate)
+{
+	int nf = faces.size(), noor = 0, ndegen = 0;
+#pragma omp parallel for reduction(+:noor,ndegen)
+	for (int i = 0; i < nf; i++) {
+		int a = faces[i][0], b = faces[i][1], c = faces[i][2];
+		if (a > b) swap(a, b);
+		if (b > c) swap(b, c);
+		if (a > b) swap(a, b);
+		tri[3*i] = a; tri[3*i+1] = b; tri[3*i+2] = c;
+		if (a < 0 || c >= nv) {
+			state[i] = FACE_OUT_OF_RANGE;
+			noor++;
+		} else if (a == b || b == c) {
+			state[i] = FACE_DEGENERATE;
+			ndegen++;
+		} else {
+			state[i] = FACE_OK;
+		}
+	}
+	out_of_range = noor;
+	degenerate = ndegen;
+}
+
+
+// Remove the bad faces the repair flags ask for, if there are any
+static void remove_bad_faces(vector<Face> &faces,
+	const vector<signed char> &state, int repair, int nbad,
+	TriMesh::Validation &v)
+{
+	int remove_mask = 0;
+	if (repair & TriMesh::REPAIR_OUT_OF_RANGE)
+		remove_mask |= 1 << FACE_OUT_OF_RANGE;
+	if (repair & TriMesh::REPAIR_DEGENERATE)
+		remove_mask |= 1 << FACE_DEGENERATE;
+	if (repair & TriMesh::REPAIR_DUPLICATE)
+		remove_mask |= 1 << FACE_DUPLICATE;
+	if (!remove_mask || !nbad)
+		return;
+
+	int nf = faces.size(), nkept = 0;
+	for (int i = 0; i < nf; i++) {
+		if (remove_mask & (1 << state[i]))
+			continue;
+		if (nkept != i)
+			faces[nkept] = faces[i];
+		nkept++;
+	}
+	v.removed = nf - nkept;
+	faces.erase(faces.begin() + nkept, faces.end());
+}
+
+
+// Check the faces, and fix whatever the repair flags say.  The offset
+// repair is the old check for indices going from 1..N instead of 0..N-1;
+// the other counts are taken after it has been applied.  Duplicates are
+// faces with the same vertices as an earlier face, in either orientation;
+// the first copy is kept.  Non-manifold edges are counted among the faces
+// that pass all the other checks.  Those two need every face and edge
+// bucketed, which costs several times the rest, so they're only done if
+// topology is set (or duplicates are to be removed).
+TriMesh::Validation TriMesh::validate(int repair /* = 0 */,
+				      bool topology /* = true */)
+{
+	Validation v;
+	int nv = vertices.size(), nf = faces.size();
+	if (repair & REPAIR_DUPLICATE)
+		topology = true;
+	v.topology_checked = topology;
+	if (!nf)
+		return v;
+
+	// Index range, out-of-range and degenerate faces.  Everything after
+	// this works from a compact sorted copy, since Faces are big.
+	vector<int> tri(3 * nf);
+	vector<signed char> state(nf);
+	int out_of_range, degenerate;
+	classify_faces(faces, nv, tri, state, out_of_range, degenerate);
+
+	int min_ind = tri[0], max_ind = tri[2];
+#pragma omp parallel for reduction(min:min_ind) reduction(max:max_ind)
+	for (int i = 0; i < nf; i++) {
+		min_ind = min(min_ind, tri[3*i]);
+		max_ind = max(max_ind, tri[3*i+2]);
+	}
+	v.min_ind = min_ind;
+	v.max_ind = max_ind;
+
+	bool changed = false;
+	if ((repair & REPAIR_OFFSET) && min_ind != 0 &&
+	    max_ind - min_ind == nv - 1) {
+		v.offset = min_ind;
+#pragma omp parallel for
+		for (int i = 0; i < nf; i++)
+			for (int j = 0; j < 3; j++)
+				faces[i][j] -= min_ind;
+		classify_faces(faces, nv, tri, state, out_of_range, degenerate);
+		changed = true;
+	}
+	v.out_of_range = out_of_range;
+	v.degenerate = degenerate;
+	if (!topology) {
+		remove_bad_faces(faces, state, repair, out_of_range + degenerate, v);
+		if (changed || v.removed)
+			faces_changed();
+		return v;
+	}
+
+	// Bucket the good faces by their lowest vertex a, keyed by the other
+	// two (b,c).  Later copies of a face are duplicates.
+	typedef pair<long long, int> FaceKey;
+	vector<int> fstart(nv + 1);
+	for (int i = 0; i < nf; i++)
+		if (state[i] == FACE_OK)
+			fstart[tri[3*i] + 1]++;
+	prefix_sum(fstart);
+	vector<FaceKey> keys(fstart[nv]);
+	vector<int> next(fstart.begin(), fstart.end() - 1);
+	for (int i = 0; i < nf; i++) {
+		if (state[i] != FACE_OK)
+			continue;
+		long long bc = ((long long) tri[3*i+1] << 32) | tri[3*i+2];
+		keys[next[tri[3*i]]++] = FaceKey(bc, i);
+	}
+	vector<int>().swap(tri);
+	sort_rows(fstart, keys);
+
+	int duplicate = 0;
+#pragma omp parallel for reduction(+:duplicate) schedule(dynamic, 4096)
+	for (int i = 0; i < nv; i++) {
+		for (int k = fstart[i] + 1; k < fstart[i+1]; k++) {
+			if (keys[k].first == keys[k-1].first) {
+				state[keys[k].second] = FACE_DUPLICATE;
+				keys[k].second = -1;
+				duplicate++;
+			}
+		}
+	}
+	v.duplicate = duplicate;
+
+	// Bucket the edges of the other faces by their lower vertex:
+	// (a,b) and (a,c) go with a, and (b,c) with b.  Any that show up
+	// more than twice are non-manifold.
+	vector<int> estart(nv + 1);
+	for (int i = 0; i < nv; i++) {
+		for (int k = fstart[i]; k < fstart[i+1]; k++) {
+			if (keys[k].second < 0)
+				continue;
+			estart[i + 1] += 2;
+			estart[(keys[k].first >> 32) + 1]++;
+		}
+	}
+	prefix_sum(estart);
+	vector<int> other(estart[nv]);
+	next.assign(estart.begin(), estart.end() - 1);
+	for (int i = 0; i < nv; i++) {
+		for (int k = fstart[i]; k < fstart[i+1]; k++) {
+			if (keys[k].second < 0)
+				continue;
+			int b = keys[k].first >> 32, c = keys[k].first & 0xffffffff;
+			other[next[i]++] = b;
+			other[next[i]++] = c;
+			other[next[b]++] = c;
+		}
+	}
+	vector<FaceKey>().swap(keys);
+	sort_rows(estart, other);
+
+	int nonmanifold = 0;
+#pragma omp parallel for reduction(+:nonmanifold) schedule(dynamic, 4096)
+	for (int i = 0; i < nv; i++) {
+		for (int k = estart[i]; k < estart[i+1]; ) {
+			int run = 1;
+			while (k + run < estart[i+1] && other[k+run] == other[k])
+				run++;
+			if (run > 2)
+				nonmanifold++;
+			k += run;
+		}
+	}
+	v.nonmanifold_edges = nonmanifold;
+
+	remove_bad_faces(faces, state, repair, out_of_range + degenerate + duplicate, v);
+	if (changed || v.removed)
+		faces_changed();
+	return v;
+}
@@ -0,0 +1,482 @@
+/*
+decimate.cc
+Simplify a mesh by quadric-error half-edge collapses.
+
+Uses the error metric from
+ Garland, M. and Heckbert, P.
+ "Surface Simplification Using Quadric Error Metrics,"
+ Proc. SIGGRAPH, 1997.
+
+Each collapse moves one vertex onto a neighbor, so surviving vertices keep
+their positions and per-vertex properties, and texture coordinates can be
+carried along by index.  Boundary vertices never move (though interior
+vertices may collapse onto them), so borders come through unchanged.
+Vertices on non-manifold edges or texture seams are left alone entirely.
+*/
+
+#include <stdio.h>
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include "timestamp.h"
+#include <queue>
+#include <functional>
+#include <algorithm>
+using namespace std;
+
+
+// Don't let a collapse turn any face by more than this (cosine)
+#define DECIMATE_MIN_COS 0.2f
+
+// Largest vertex fan we are willing to walk
+#define DECIMATE_MAX_VALENCE 1024
+
+
+// Half-edge h goes from corner h%3 of face h/3 to the next corner
+#define HE_NEXT(h) ((h) % 3 == 2 ? (h) - 2 : (h) + 1)
+#define HE_PREV(h) ((h) % 3 == 0 ? (h) + 2 : (h) - 1)
+
+
+// What a vertex is allowed to do
+enum { V_FREE, V_BOUNDARY, V_FROZEN };
+
+
+// Symmetric 4x4 quadric, upper triangle
+struct Quadric {
+	double q[10];
+	Quadric() { for (int i = 0; i < 10; i++) q[i] = 0.0; }
+	void add_plane(double a, double b, double c, double d, double w)
+	{
+		q[0] += w*a*a; q[1] += w*a*b; q[2] += w*a*c; q[3] += w*a*d;
+		q[4] += w*b*b; q[5] += w*b*c; q[6] += w*b*d;
+		q[7] += w*c*c; q[8] += w*c*d;
+		q[9] += w*d*d;
+	}
+	Quadric &operator += (const Quadric &o)
+	{
+		for (int i = 0; i < 10; i++) q[i] += o.q[i];
+		return *this;
+	}
+	double eval(const point &p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		return x*(q[0]*x + 2.0*(q[1]*y + q[2]*z + q[3])) +
+		       y*(q[4]*y + 2.0*(q[5]*z + q[6])) +
+		       z*(q[7]*z + 2.0*q[8]) + q[9];
+	}
+};
+
+
+// Cheapest collapse of vertex u (onto whichever neighbor that is, which is
+// worked out again when popped).  Quadrics only ever grow, so the cost can
+// only have gone up since the entry was pushed: it is a lower bound, and an
+// entry that turns out to be too cheap just goes back in at its real cost.
+// Entries for a vertex go stale once it has been pushed again.
+struct Collapse {
+	float cost;
+	int u;
+	unsigned gen;
+	bool operator > (const Collapse &o) const { return cost > o.cost; }
+};
+
+
+// Everything the collapses work on, as flat arrays
+struct Decimator {
+	TriMesh *mesh;
+	vector<int> fv;		// 3 vertices per face
+	vector<int> opp;	// Opposite half-edge, or -1
+	vector<int> vhe;	// Some half-edge leaving each vertex
+	vector<int> vvt;	// Texture coord of each vertex, -1 if none
+	vector<char> fdead, vdead, state, queued;
+	vector<unsigned> gen;
+	vector<Quadric> quad;
+	vector<unsigned> mark;
+	unsigned curr_mark;
+	priority_queue< Collapse, vector<Collapse>, greater<Collapse> > heap;
+
+	int dest(int h) const { return fv[HE_NEXT(h)]; }
+
+	void next_mark()
+	{
+		if (++curr_mark == 0) {
+			fill(mark.begin(), mark.end(), 0);
+			curr_mark = 1;
+		}
+	}
+
+	// Half-edges leaving v, walking around it in both directions in
+	// case the fan is open.  False if the fan is too big.
+	bool fan(int v, vector<int> &hes) const;
+
+	// Distinct neighbors of v
+	void ring(int v, vector<int> &hes, vector<int> &verts);
+
+	// Error of moving u onto v
+	float cost(int u, int v) const
+	{
+		Quadric q = quad[u];
+		q += quad[v];
+		return (float) max(q.eval(mesh->vertices[v]), 0.0);
+	}
+
+	// Queue up the cheapest collapse of u
+	void push(int u, vector<int> &hes)
+	{
+		if (state[u] != V_FREE || !fan(u, hes))
+			return;
+		Collapse c;
+		c.cost = -1.0f;
+		for (size_t i = 0; i < hes.size(); i++) {
+			int v = dest(hes[i]);
+			if (state[v] == V_FROZEN)
+				continue;
+			float cv = cost(u, v);
+			if (c.cost < 0.0f || cv < c.cost)
+				c.cost = cv;
+		}
+		if (c.cost < 0.0f)
+			return;
+		c.u = u;
+		c.gen = gen[u];
+		heap.push(c);
+		queued[u] = 1;
+	}
+
+	bool valid(int u, int v, vector<int> &ufan, vector<int> &vfan,
+		   int &huv);
+	void collapse(int u, int v, int huv, const vector<int> &ufan);
+};
+
+
+// Half-edges leaving v
+bool Decimator::fan(int v, vector<int> &hes) const
+{
+	hes.clear();
+	int h0 = vhe[v], h = h0;
+	do {
+		hes.push_back(h);
+		if (hes.size() > DECIMATE_MAX_VALENCE)
+			return false;
+		h = opp[HE_PREV(h)];
+	} while (h >= 0 && h != h0);
+	if (h == h0)
+		return true;
+
+	// Open fan: go back the other way
+	h = h0;
+	while (opp[h] >= 0) {
+		h = HE_NEXT(opp[h]);
+		hes.push_back(h);
+		if (hes.size() > DECIMATE_MAX_VALENCE)
+			return false;
+	}
+	return true;
+}
+
+
+// Distinct neighbors of v
+void Decimator::ring(int v, vector<int> &hes, vector<int> &verts)
+{
+	verts.clear();
+	if (!fan(v, hes))
+		return;
+	next_mark();
+	mark[v] = curr_mark;
+	for (size_t i = 0; i < hes.size(); i++) {
+		int w[2] = { dest(hes[i]), fv[HE_PREV(hes[i])] };
+		for (int k = 0; k < 2; k++) {
+			if (mark[w[k]] != curr_mark) {
+				mark[w[k]] = curr_mark;
+				verts.push_back(w[k]);
+			}
+		}
+	}
+}
+
+
+// Can u still be collapsed onto v?  If so, returns the fan of u and the
+// half-edge from u to v.
+bool Decimator::valid(int u, int v, vector<int> &ufan, vector<int> &vfan,
+		      int &huv)
+{
+	if (!fan(u, ufan) || !fan(v, vfan))
+		return false;
+
+	// Don't flatten a tetrahedron
+	if (ufan.size() == 3 && vfan.size() == 3)
+		return false;
+
+	// Link condition: u and v may only have the two vertices opposite
+	// the edge as common neighbors
+	huv = -1;
+	next_mark();
+	for (size_t i = 0; i < ufan.size(); i++) {
+		if (dest(ufan[i]) == v)
+			huv = ufan[i];
+		mark[dest(ufan[i])] = curr_mark;
+	}
+	if (huv < 0)
+		return false;
+	mark[v] = 0;
+	int nshared = 0;
+	for (size_t i = 0; i < vfan.size(); i++) {
+		// Neighbors both ahead of and behind each half-edge, to
+		// cover the ends of an open fan
+		int w[2] = { dest(vfan[i]), fv[HE_PREV(vfan[i])] };
+		for (int k = 0; k < 2; k++) {
+			if (mark[w[k]] == curr_mark) {
+				nshared++;
+				mark[w[k]] = 0;
+			}
+		}
+	}
+	if (nshared != 2)
+		return false;
+
+	// Don't fold any face over
+	const point &pu = mesh->vertices[u], &pv = mesh->vertices[v];
+	int f0 = huv / 3, f1 = opp[huv] / 3;
+	for (size_t i = 0; i < ufan.size(); i++) {
+		int h = ufan[i], f = h / 3;
+		if (f == f0 || f == f1)
+			continue;
+		const point &p1 = mesh->vertices[fv[HE_NEXT(h)]];
+		const point &p2 = mesh->vertices[fv[HE_PREV(h)]];
+		vec nold = (p1 - pu) CROSS (p2 - pu);
+		vec nnew = (p1 - pv) CROSS (p2 - pv);
+		float l2old = len2(nold), l2new = len2(nnew);
+		if (!l2new)
+			return false;
+		if ((nold DOT nnew) < DECIMATE_MIN_COS * sqrt(l2old * l2new))
+			return false;
+	}
+	return true;
+}
+
+
+// Collapse u onto v along half-edge huv
+void Decimator::collapse(int u, int v, int huv, const vector<int> &ufan)
+{
+	// Sew up the outer edges of the two faces that go away.  u is
+	// interior, so the edges touching it always have opposites; the
+	// ones between v and the third vertex might be on the boundary.
+	int dying[2] = { huv, opp[huv] };
+	for (int k = 0; k < 2; k++) {
+		int h = dying[k];
+		int on = opp[HE_NEXT(h)], op = opp[HE_PREV(h)];
+		if (on >= 0)
+			opp[on] = op;
+		if (op >= 0)
+			opp[op] = on;
+		fdead[h / 3] = 1;
+
+		// The third vertex keeps a half-edge that survives, as does v
+		// (op leaves u or v, and either way ends up leaving v)
+		vhe[fv[HE_PREV(h)]] = (on >= 0) ? on : HE_NEXT(op);
+		if (op >= 0)
+			vhe[v] = op;
+	}
+
+	// Everything that was around u is now around v
+	for (size_t i = 0; i < ufan.size(); i++) {
+		int h = ufan[i], f = h / 3;
+		if (fdead[f])
+			continue;
+		fv[h] = v;
+		if (vvt[v] >= 0)
+			mesh->faces[f].vt[h % 3] = vvt[v];
+	}
+
+	vdead[u] = 1;
+	quad[v] += quad[u];
+}
+
+
+// Decimate the mesh down to (about) the given number of faces, stopping
+// early if no more collapses are possible
+void decimate(TriMesh *mesh, int target_nfaces)
+{
+	mesh->need_faces();
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+	int nv = mesh->vertices.size(), nf = mesh->faces.size();
+	if (nf <= target_nfaces)
+		return;
+	mesh->need_adjacentfaces();
+
+	TriMesh::dprintf("Decimating mesh... ");
+	timestamp t = now();
+
+	Decimator d;
+	d.mesh = mesh;
+	d.fv.resize(3*nf);
+	d.opp.resize(3*nf);
+	d.vhe.resize(nv, -1);
+	d.vvt.resize(nv, -1);
+	d.fdead.resize(nf);
+	d.vdead.resize(nv);
+	d.state.resize(nv);
+	d.queued.resize(nv);
+	d.gen.resize(nv);
+	d.quad.resize(nv);
+	d.mark.resize(nv);
+	d.curr_mark = 0;
+
+	// Half-edges and their opposites: a->b pairs with the only b->a, as
+	// long as it is also the only a->b
+	const vector< vector<int> > &adj = mesh->adjacentfaces;
+#pragma omp parallel for
+	for (int f = 0; f < nf; f++)
+		for (int k = 0; k < 3; k++)
+			d.fv[3*f+k] = mesh->faces[f][k];
+#pragma omp parallel for
+	for (int h = 0; h < 3*nf; h++) {
+		int a = d.fv[h], b = d.dest(h);
+		int found = -1, nfwd = 0, nback = 0;
+		const vector<int> &af = adj[a];
+		for (size_t i = 0; i < af.size(); i++) {
+			int g = af[i];
+			if (i > 0 && af[i-1] == g)
+				continue;
+			for (int k = 0; k < 3; k++) {
+				int gh = 3*g + k;
+				if (d.fv[gh] == a && d.dest(gh) == b)
+					nfwd++;
+				if (d.fv[gh] == b && d.dest(gh) == a) {
+					found = gh;
+					nback++;
+				}
+			}
+		}
+		d.opp[h] = (nfwd == 1 && nback == 1) ? found : -1;
+	}
+
+	// Boundary vertices stay put.  Vertices in degenerate faces, and
+	// ones whose faces don't form a single fan, are frozen.
+	for (int h = 0; h < 3*nf; h++) {
+		int a = d.fv[h], b = d.dest(h);
+		d.vhe[a] = h;
+		if (a == b)
+			d.state[a] = V_FROZEN;
+		else if (d.opp[h] < 0 && d.state[a] == V_FREE)
+			d.state[a] = V_BOUNDARY;
+		if (d.opp[h] < 0 && d.state[b] == V_FREE)
+			d.state[b] = V_BOUNDARY;
+	}
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		if (d.vhe[i] < 0) {
+			d.state[i] = V_FROZEN;
+			continue;
+		}
+		if (d.state[i] == V_FROZEN)
+			continue;
+		const vector<int> &af = adj[i];
+		size_t nfaces = 0;
+		for (size_t k = 0; k < af.size(); k++)
+			if (k == 0 || af[k-1] != af[k])
+				nfaces++;
+		vector<int> hes;
+		if (!d.fan(i, hes) || hes.size() != nfaces)
+			d.state[i] = V_FROZEN;
+	}
+
+	// Texture coordinates: a vertex with one consistent vt carries it
+	// along; one on a seam is frozen
+	if (!mesh->vts.empty()) {
+		for (int f = 0; f < nf; f++) {
+			for (int k = 0; k < 3; k++) {
+				int v = d.fv[3*f+k], vt = mesh->faces[f].vt[k];
+				if (d.vvt[v] == -1)
+					d.vvt[v] = vt;
+				else if (d.vvt[v] != vt)
+					d.state[v] = V_FROZEN;
+			}
+		}
+	}
+
+	// Quadrics: area-weighted face planes
+	vector<Quadric> fquad(nf);
+#pragma omp parallel for
+	for (int f = 0; f < nf; f++) {
+		const point &p0 = mesh->vertices[d.fv[3*f]];
+		const point &p1 = mesh->vertices[d.fv[3*f+1]];
+		const point &p2 = mesh->vertices[d.fv[3*f+2]];
+		vec n = (p1 - p0) CROSS (p2 - p0);
+		float l = len(n);
+		if (!l)
+			continue;
+		n /= l;
+		fquad[f].add_plane(n[0], n[1], n[2], -(n DOT p0), 0.5 * l);
+	}
+	for (int f = 0; f < nf; f++)
+		for (int k = 0; k < 3; k++)
+			d.quad[d.fv[3*f+k]] += fquad[f];
+	vector<Quadric>().swap(fquad);
+
+	// Seed the heap with each vertex
+	vector<int> ufan, vfan, nbrs;
+	vector< pair<float,int> > targets;
+	for (int i = 0; i < nv; i++)
+		d.push(i, ufan);
+
+	// Collapse, cheapest first
+	int nalive = nf, ncollapses = 0;
+	while (nalive > target_nfaces && !d.heap.empty()) {
+		Collapse c = d.heap.top();
+		d.heap.pop();
+		int u = c.u;
+		if (d.vdead[u] || c.gen != d.gen[u] || !d.fan(u, ufan))
+			continue;
+
+		// Try the neighbors in order of cost.  If the cheapest ones
+		// can't be used right now, u goes back in at its real cost, and
+		// if none can, u waits until something nearby changes.
+		targets.clear();
+		for (size_t i = 0; i < ufan.size(); i++) {
+			int v = d.dest(ufan[i]);
+			if (d.state[v] != V_FROZEN)
+				targets.push_back(make_pair(d.cost(u, v), v));
+		}
+		sort(targets.begin(), targets.end());
+		size_t i = 0;
+		int huv = -1;
+		while (i < targets.size() &&
+		       !d.valid(u, targets[i].second, ufan, vfan, huv))
+			i++;
+		if (i == targets.size()) {
+			d.queued[u] = 0;
+			continue;
+		}
+		if (targets[i].first > c.cost) {
+			c.cost = targets[i].first;
+			d.heap.push(c);
+			continue;
+		}
+		int v = targets[i].second;
+
+		d.collapse(u, v, huv, ufan);
+		nalive -= 2;
+		ncollapses++;
+
+		// v has a new cost, and neighbors that had nothing to collapse
+		// onto might now
+		d.gen[v]++;
+		d.push(v, ufan);
+		d.ring(v, vfan, nbrs);
+		for (size_t i = 0; i < nbrs.size(); i++)
+			if (!d.queued[nbrs[i]])
+				d.push(nbrs[i], ufan);
+	}
+
+	// Write the faces back, and drop what went away
+	vector<bool> toremove(nf);
+	for (int f = 0; f < nf; f++) {
+		toremove[f] = d.fdead[f];
+		for (int k = 0; k < 3; k++)
+			mesh->faces[f][k] = d.fv[3*f+k];
+	}
+	TriMesh::dprintf("%d collapses, %f sec.\n", ncollapses, now() - t);
+	mesh->faces_changed();
+	remove_faces(mesh, toremove);
+	remove_unused_vertices(mesh);
+}
@@ -11,6 +11,7 @@ Smoothing of meshes and per-vertex fields
 #include "TriMesh_algo.h"
 #include "timestamp.h"
 #include <cmath>
+#include <algorithm>
 using namespace std;
 
 
@@ -66,33 +67,55 @@ struct AccumDCurv {
 };
 
 
-// Diffuse a vector field at 1 vertex, weighted by
-// a Gaussian of width 1/sqrt(invsigma2)
-template <class ACCUM, class T>
-static void diffuse_vert_field(TriMesh *themesh, ACCUM accum,
-			       int v, float invsigma2, T &flt)
+// Traversal state for diffuse_vert_field, one per thread: a vertex has
+// been visited iff its stamp is the current one, so starting a new
+// traversal is just a matter of bumping the stamp.
+struct DiffuseScratch {
+	vector<unsigned> stamps;
+	unsigned curr;
+	vector<int> stack;
+
+	DiffuseScratch(int nv) : stamps(nv), curr(0)
+		{}
+	unsigned next()
+	{
+		if (++curr == 0) {
+			fill(stamps.begin(), stamps.end(), 0u);
+			curr = 1;
+		}
+		return curr;
+	}
+};
+
+
+// Walk the neighborhood of vertex v that gets nonzero weight in a
+// Gaussian of width 1/sqrt(invsigma2), calling visit(n, w) for each
+// vertex n in it (starting with v itself).  Returns the sum of weights.
+template <class VISIT>
+static float diffuse_traverse(const TriMesh *themesh, int v, float invsigma2,
+			      DiffuseScratch &scratch, VISIT &visit)
 {
 	if (themesh->neighbors[v].empty()) {
-		flt = T();
-		accum(themesh, v, flt, 1.0f, v);
-		return;
+		visit(v, 1.0f);
+		return 1.0f;
 	}
 
-	flt = T();
-	accum(themesh, v, flt, themesh->pointareas[v], v);
+	visit(v, themesh->pointareas[v]);
 	float sum_w = themesh->pointareas[v];
 	const vec &nv = themesh->normals[v];
 
-	unsigned &flag = themesh->flag_curr;
-	flag++;
-	themesh->flags[v] = flag;
-	vector<int> boundary = themesh->neighbors[v];
+	vector<unsigned> &flags = scratch.stamps;
+	unsigned flag = scratch.next();
+	flags[v] = flag;
+	vector<int> &boundary = scratch.stack;
+	boundary.assign(themesh->neighbors[v].begin(),
+			themesh->neighbors[v].end());
 	while (!boundary.empty()) {
 		int n = boundary.back();
 		boundary.pop_back();
-		if (themesh->flags[n] == flag)
+		if (flags[n] == flag)
 			continue;
-		themesh->flags[n] = flag;
+		flags[n] = flag;
 		if ((nv DOT themesh->normals[n]) <= 0.0f)
 			continue;
 		// Gaussian weight
@@ -104,44 +127,184 @@ static void diffuse_vert_field(TriMesh *themesh, ACCUM accum,
 		// Surface area "belonging" to each point
 		w *= themesh->pointareas[n];
 		// Accumulate weight times field at neighbor
-		accum(themesh, v, flt, w, n);
+		visit(n, w);
 		sum_w += w;
 		for (int i = 0; i < themesh->neighbors[n].size(); i++) {
 			int nn = themesh->neighbors[n][i];
-			if (themesh->flags[nn] == flag)
+			if (flags[nn] == flag)
 				continue;
 			boundary.push_back(nn);
 		}
 	}
-	flt /= sum_w;
+	return sum_w;
 }
 
 
-// Smooth the mesh geometry.
-// XXX - this is perhaps not a great way to do this,
-// but it seems to work better than most other things I've tried...
-void smooth_mesh(TriMesh *themesh, float sigma)
+// Visitor that accumulates a field around vertex v0
+template <class ACCUM, class T>
+struct VisitAccum {
+	const TriMesh *themesh;
+	ACCUM &accum;
+	int v0;
+	T &flt;
+	VisitAccum(const TriMesh *themesh_, ACCUM &accum_, int v0_, T &flt_) :
+		themesh(themesh_), accum(accum_), v0(v0_), flt(flt_)
+		{}
+	void operator() (int n, float w)
+	{
+		accum(themesh, v0, flt, w, n);
+	}
+};
+
+
+// Visitor that records the neighborhood as a stencil row
+struct VisitRecord {
+	vector<int> &index;
+	vector<float> &weight;
+	VisitRecord(vector<int> &index_, vector<float> &weight_) :
+		index(index_), weight(weight_)
+		{}
+	void operator() (int n, float w)
+	{
+		index.push_back(n);
+		weight.push_back(w);
+	}
+};
+
+
+// Diffuse a vector field at 1 vertex, weighted by
+// a Gaussian of width 1/sqrt(invsigma2)
+template <class ACCUM, class T>
+static void diffuse_vert_field(const TriMesh *themesh, ACCUM accum,
+			       int v, float invsigma2, T &flt,
+			       DiffuseScratch &scratch)
+{
+	flt = T();
+	VisitAccum<ACCUM,T> visit(themesh, accum, v, flt);
+	float sum_w = diffuse_traverse(themesh, v, invsigma2, scratch, visit);
+	if (!themesh->neighbors[v].empty())
+		flt /= sum_w;
+}
+
+
+// Diffuse a field at every vertex into out, in parallel
+template <class ACCUM, class T>
+static void diffuse_field(const TriMesh *themesh, ACCUM accum,
+			  float invsigma2, vector<T> &out)
 {
-	themesh->need_faces();
-	diffuse_normals(themesh, 0.5f * sigma);
 	int nv = themesh->vertices.size();
+	out.resize(nv);
+#pragma omp parallel
+	{
+		DiffuseScratch scratch(nv);
+#pragma omp for schedule(dynamic, 64)
+		for (int i = 0; i < nv; i++)
+			diffuse_vert_field(themesh, accum, i, invsigma2,
+					   out[i], scratch);
+	}
+}
 
-	TriMesh::dprintf("\rSmoothing... ");
+
+// The same, with the neighborhoods and weights taken from a stencil
+template <class ACCUM, class T>
+static void diffuse_field(const TriMesh *themesh, ACCUM accum,
+			  const DiffusionStencil &stencil, vector<T> &out)
+{
+	int nv = stencil.sum_w.size();
+	out.resize(nv);
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int i = 0; i < nv; i++) {
+		T flt = T();
+		for (int j = stencil.start[i]; j < stencil.start[i+1]; j++)
+			accum(themesh, i, flt, stencil.weight[j],
+			      stencil.index[j]);
+		// Isolated vertices have sum_w == 1, so this is a no-op
+		flt /= stencil.sum_w[i];
+		out[i] = flt;
+	}
+}
+
+
+// Build the stencil for diffusion with width sigma, using the current
+// normals and pointareas.  Rows are built in parallel, in chunks of
+// vertices, then concatenated.
+void build_diffusion_stencil(TriMesh *themesh, float sigma,
+			     DiffusionStencil &stencil)
+{
+	int nv = themesh->vertices.size();
+	if ((int) themesh->normals.size() != nv)
+		themesh->need_normals();
+	themesh->need_pointareas();
+	themesh->need_neighbors();
+
+	TriMesh::dprintf("Building diffusion stencil... ");
 	timestamp t = now();
 
 	float invsigma2 = 1.0f / sqr(sigma);
+	const int chunk = 1024;
+	int nchunks = (nv + chunk - 1) / chunk;
+	vector< vector<int> > cindex(nchunks);
+	vector< vector<float> > cweight(nchunks);
+	stencil.sigma = sigma;
+	stencil.start.resize(nv + 1);
+	stencil.sum_w.resize(nv);
+
+#pragma omp parallel
+	{
+		DiffuseScratch scratch(nv);
+#pragma omp for schedule(dynamic)
+		for (int c = 0; c < nchunks; c++) {
+			VisitRecord visit(cindex[c], cweight[c]);
+			int end = min(nv, (c + 1) * chunk);
+			for (int i = c * chunk; i < end; i++) {
+				stencil.start[i] = cindex[c].size();
+				stencil.sum_w[i] = diffuse_traverse(themesh,
+					i, invsigma2, scratch, visit);
+			}
+		}
+	}
 
-	vector<point> dflt(nv);
-	for (int i = 0; i < nv; i++) {
-		diffuse_vert_field(themesh, AccumVec(themesh->vertices),
-				   i, invsigma2, dflt[i]);
-		// Just keep the displacement
-		dflt[i] -= themesh->vertices[i];
+	// Row starts are relative to their chunk until now
+	vector<int> offset(nchunks + 1);
+	for (int c = 0; c < nchunks; c++)
+		offset[c+1] = offset[c] + cindex[c].size();
+	stencil.start[nv] = offset[nchunks];
+	stencil.index.resize(offset[nchunks]);
+	stencil.weight.resize(offset[nchunks]);
+#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < nchunks; c++) {
+		int end = min(nv, (c + 1) * chunk);
+		for (int i = c * chunk; i < end; i++)
+			stencil.start[i] += offset[c];
+		copy(cindex[c].begin(), cindex[c].end(),
+		     stencil.index.begin() + offset[c]);
+		copy(cweight[c].begin(), cweight[c].end(),
+		     stencil.weight.begin() + offset[c]);
+		vector<int>().swap(cindex[c]);
+		vector<float>().swap(cweight[c]);
 	}
 
-	// Slightly better small-neighborhood approximation
+	TriMesh::dprintf("Done.  %lu entries, %f sec.\n",
+		(unsigned long) stencil.index.size(), now() - t);
+}
+
+
+// Diffuse a per-vertex vector field with a precomputed stencil
+void diffuse_vector_field(const TriMesh *themesh,
+			  const DiffusionStencil &stencil,
+			  const vector<vec> &field, vector<vec> &out)
+{
+	diffuse_field(themesh, AccumVec(field), stencil, out);
+}
+
+
+// Slightly better small-neighborhood approximation, added to the
+// smoothed-position displacements dflt
+static void add_local_displacement(TriMesh *themesh, float invsigma2,
+				   vector<point> &dflt)
+{
 	int nf = themesh->faces.size();
-#pragma omp parallel for
+//#pragma omp parallel for
 	for (int i = 0; i < nf; i++) {
 		point c = themesh->vertices[themesh->faces[i][0]] +
 			  themesh->vertices[themesh->faces[i][1]] +
@@ -155,18 +318,80 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 				   exp(-0.5f * invsigma2 * len2(d)) * d;
 		}
 	}
+}
+
+
+// Smooth the mesh geometry.
+// XXX - this is perhaps not a great way to do this,
+// but it seems to work better than most other things I've tried...
+void smooth_mesh(TriMesh *themesh, float sigma)
+{
+	themesh->need_faces();
+	diffuse_normals(themesh, 0.5f * sigma);
+	int nv = themesh->vertices.size();
+
+	TriMesh::dprintf("\rSmoothing... ");
+	timestamp t = now();
+
+	float invsigma2 = 1.0f / sqr(sigma);
+
+	vector<point> dflt;
+	diffuse_field(themesh, AccumVec(themesh->vertices), invsigma2, dflt);
+	// Just keep the displacement
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		dflt[i] -= themesh->vertices[i];
+
+	add_local_displacement(themesh, invsigma2, dflt);
 
 	// Filter displacement field
-	vector<point> dflt2(nv);
-	for (int i = 0; i < nv; i++) {
-		diffuse_vert_field(themesh, AccumVec(dflt),
-				   i, invsigma2, dflt2[i]);
-	}
+	vector<point> dflt2;
+	diffuse_field(themesh, AccumVec(dflt), invsigma2, dflt2);
 
 	// Update vertex positions
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++)
 		themesh->vertices[i] += dflt[i] - dflt2[i]; // second Laplacian
+	themesh->vertices_changed();
+
+	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
+}
+
+
+// Smooth the mesh geometry with weights frozen in a stencil.  With a
+// stencil built right after diffuse_normals(themesh, 0.5f * sigma), the
+// first call gives the same result as smooth_mesh(themesh, sigma).
+void smooth_mesh(TriMesh *themesh, const DiffusionStencil &stencil)
+{
+	themesh->need_faces();
+	themesh->need_pointareas();
+	themesh->need_neighbors();
+	int nv = themesh->vertices.size();
+	if ((int) stencil.sum_w.size() != nv) {
+		TriMesh::dprintf("Stencil doesn't match mesh!\n");
+		return;
+	}
+
+	TriMesh::dprintf("\rSmoothing... ");
+	timestamp t = now();
+
+	float invsigma2 = 1.0f / sqr(stencil.sigma);
+
+	vector<point> dflt;
+	diffuse_field(themesh, AccumVec(themesh->vertices), stencil, dflt);
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		dflt[i] -= themesh->vertices[i];
+
+	add_local_displacement(themesh, invsigma2, dflt);
+
+	vector<point> dflt2;
+	diffuse_field(themesh, AccumVec(dflt), stencil, dflt2);
+
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		themesh->vertices[i] += dflt[i] - dflt2[i];
+	themesh->vertices_changed();
 
 	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
@@ -262,6 +487,194 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 	// Pass II: bilateral
 	for (int i = 0; i < nv; i++)
 		jones_filter(themesh, i, invsigma2_1, invsigma2_2, false, mpoints);
+	themesh->vertices_changed();
+
+	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
+}
+
+
+// Face centroids bucketed in a uniform grid, for finding the faces near
+// a point without walking the mesh.  Faces are sorted by cell, and their
+// original indices, centroids, areas and (once filled in) normals are
+// stored in that order as separate arrays.
+struct FaceGrid {
+	enum { BITS = 21, BIAS = 1 << (BITS - 1) };
+	float invcell;
+	point origin;
+	vector<unsigned long long> keys;
+	vector<int> face;
+	vector<float> cx, cy, cz, area, nx, ny, nz;
+
+	static unsigned long long key(int x, int y, int z)
+	{
+		return ((unsigned long long) (x + BIAS) << (2 * BITS)) |
+		       ((unsigned long long) (y + BIAS) << BITS) |
+		       (unsigned long long) (z + BIAS);
+	}
+	void cell(const point &p, int c[3]) const
+	{
+		for (int k = 0; k < 3; k++)
+			c[k] = (int) floor(invcell * (p[k] - origin[k]));
+	}
+
+	// Range [begin, end) of faces in the row of cells (x, y, z0..z1)
+	void row(int x, int y, int z0, int z1, int &begin, int &end) const
+	{
+		begin = lower_bound(keys.begin(), keys.end(), key(x, y, z0)) -
+			keys.begin();
+		end = upper_bound(keys.begin() + begin, keys.end(),
+				  key(x, y, z1)) - keys.begin();
+	}
+
+	FaceGrid(const TriMesh *themesh, float cellsize);
+};
+
+
+// Build the grid.  Cells are at least cellsize across, but are made
+// larger if needed to keep cell coordinates in range.
+FaceGrid::FaceGrid(const TriMesh *themesh, float cellsize)
+{
+	int nf = themesh->faces.size();
+	vector<point> c(nf);
+	point lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+	for (int i = 0; i < nf; i++) {
+		const Face &f = themesh->faces[i];
+		c[i] = (themesh->vertices[f[0]] + themesh->vertices[f[1]] +
+			themesh->vertices[f[2]]) * (1.0f / 3.0f);
+		for (int k = 0; k < 3; k++) {
+			lo[k] = min(lo[k], c[i][k]);
+			hi[k] = max(hi[k], c[i][k]);
+		}
+	}
+	float extent = max(max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]);
+	cellsize = max(cellsize, extent / float(BIAS / 2));
+	invcell = 1.0f / cellsize;
+	origin = lo;
+
+	vector< pair<unsigned long long, int> > order(nf);
+	for (int i = 0; i < nf; i++) {
+		int ci[3];
+		cell(c[i], ci);
+		order[i] = make_pair(key(ci[0], ci[1], ci[2]), i);
+	}
+	sort(order.begin(), order.end());
+
+	keys.resize(nf);
+	face.resize(nf);
+	cx.resize(nf);  cy.resize(nf);  cz.resize(nf);
+	area.resize(nf);
+	for (int j = 0; j < nf; j++) {
+		int i = order[j].second;
+		const Face &f = themesh->faces[i];
+		keys[j] = order[j].first;
+		face[j] = i;
+		cx[j] = c[i][0];  cy[j] = c[i][1];  cz[j] = c[i][2];
+		area[j] = len(trinorm(themesh->vertices[f[0]],
+				      themesh->vertices[f[1]],
+				      themesh->vertices[f[2]]));
+	}
+}
+
+
+// One vertex of the grid-based Jones filter.  For pass 1 (invsigma2_2
+// unused), smooth p by face centroids; for pass 2, by the predictions
+// of p from each face's plane, using the normals in the grid.
+// The grid cells must be at least 3 / sqrt(invsigma2_1) across.
+static point jones_filter_grid(const FaceGrid &grid, const point &p,
+			       float invsigma2_1, float invsigma2_2,
+			       bool pass1)
+{
+	point flt;
+	float sum_w = 0.0f;
+
+	// The grid's cells are as large as the cutoff of wt(), so the
+	// 27 cells around p hold every face that can have nonzero weight
+	int c[3];
+	grid.cell(p, c);
+	for (int dx = -1; dx <= 1; dx++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			int begin, end;
+			grid.row(c[0] + dx, c[1] + dy, c[2] - 1, c[2] + 1,
+				 begin, end);
+			for (int j = begin; j < end; j++) {
+				point fc(grid.cx[j], grid.cy[j], grid.cz[j]);
+				float w = wt(p, fc, invsigma2_1);
+				if (w == 0.0f)
+					continue;
+				w *= grid.area[j];
+				if (pass1) {
+					flt += w * fc;
+					sum_w += w;
+					continue;
+				}
+				vec fn(grid.nx[j], grid.ny[j], grid.nz[j]);
+				point prediction = p - fn * ((p - fc) DOT fn);
+				w *= wt(p, prediction, invsigma2_2);
+				if (w == 0.0f)
+					continue;
+				flt += w * prediction;
+				sum_w += w;
+			}
+		}
+	}
+	if (sum_w == 0.0f)
+		return p;
+	return flt * (1.0f / sum_w);
+}
+
+
+// Bilateral smoothing using the method of [Jones et al. 2003], finding
+// the faces near each vertex in a spatial grid instead of by walking the
+// mesh.  Disconnected pieces that are close by contribute too.  Both
+// passes read only the output of the one before, and run in parallel.
+void bilateral_smooth_mesh_grid(TriMesh *themesh, float sigma1, float sigma2)
+{
+	themesh->need_faces();
+	int nv = themesh->vertices.size(), nf = themesh->faces.size();
+
+	TriMesh::dprintf("\rSmoothing... ");
+	timestamp t = now();
+
+	float sigma3 = 0.5f * sigma1;
+	float invsigma2_1 = 1.0f / sqr(sigma1);
+	float invsigma2_2 = 1.0f / sqr(sigma2);
+	float invsigma2_3 = 1.0f / sqr(sigma3);
+
+	// Pass I: mollification
+	vector<point> mpoints(nv);
+	{
+		FaceGrid grid(themesh, 3.0f * sigma3);
+#pragma omp parallel for schedule(dynamic, 256)
+		for (int i = 0; i < nv; i++)
+			mpoints[i] = jones_filter_grid(grid,
+				themesh->vertices[i], invsigma2_3, 0.0f, true);
+	}
+
+	// wt() cuts off at 3 sigma, so that is the cell size
+	FaceGrid grid(themesh, 3.0f * sigma1);
+
+	// Normals of the mollified faces
+	grid.nx.resize(nf);
+	grid.ny.resize(nf);
+	grid.nz.resize(nf);
+#pragma omp parallel for
+	for (int j = 0; j < nf; j++) {
+		const Face &f = themesh->faces[grid.face[j]];
+		vec fn = trinorm(mpoints[f[0]], mpoints[f[1]], mpoints[f[2]]);
+		normalize(fn);
+		grid.nx[j] = fn[0];
+		grid.ny[j] = fn[1];
+		grid.nz[j] = fn[2];
+	}
+
+	// Pass II: bilateral
+	vector<point> flt(nv);
+#pragma omp parallel for schedule(dynamic, 256)
+	for (int i = 0; i < nv; i++)
+		flt[i] = jones_filter_grid(grid, mpoints[i],
+					   invsigma2_1, invsigma2_2, false);
+	themesh->vertices.swap(flt);
+	themesh->vertices_changed();
 
 	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
@@ -270,27 +683,31 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 // Diffuse the normals across the mesh
 void diffuse_normals(TriMesh *themesh, float sigma)
 {
-	themesh->need_normals();
-	themesh->need_pointareas();
+	themesh->need_geometry(TriMesh::GEOM_NORMALS |
+			       TriMesh::GEOM_POINTAREAS);
 	themesh->need_neighbors();
 	int nv = themesh->vertices.size();
-	if (themesh->flags.size() != nv)
-		themesh->flags.resize(nv);
 
 	TriMesh::dprintf("\rSmoothing normals... ");
 	timestamp t = now();
 
 	float invsigma2 = 1.0f / sqr(sigma);
 
-	vector<vec> nflt(nv);
-	for (int i = 0; i < nv; i++) {
-		diffuse_vert_field(themesh, AccumVec(themesh->normals),
-				   i, invsigma2, nflt[i]);
+	vector<vec> nflt;
+	diffuse_field(themesh, AccumVec(themesh->normals), invsigma2, nflt);
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
 		normalize(nflt[i]);
-	}
 
 	themesh->normals = nflt;
 
+	// The filtered normals stay in the mesh, but are not what
+	// need_normals would give, and curvatures were computed from the
+	// old ones
+	themesh->cache_invalidate(TriMesh::CACHE_NORMALS);
+	themesh->cache_invalidate(TriMesh::CACHE_CURVATURES);
+	themesh->cache_invalidate(TriMesh::CACHE_DCURV);
+
 	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
@@ -298,22 +715,19 @@ void diffuse_normals(TriMesh *themesh, float sigma)
 // Diffuse the curvatures across the mesh
 void diffuse_curv(TriMesh *themesh, float sigma)
 {
-	themesh->need_normals();
-	themesh->need_pointareas();
+	themesh->need_geometry(TriMesh::GEOM_NORMALS |
+			       TriMesh::GEOM_POINTAREAS);
 	themesh->need_curvatures();
 	themesh->need_neighbors();
 	int nv = themesh->vertices.size();
-	if (themesh->flags.size() != nv)
-		themesh->flags.resize(nv);
 
 	TriMesh::dprintf("\rSmoothing curvatures... ");
 	timestamp t = now();
 
 	float invsigma2 = 1.0f / sqr(sigma);
 
-	vector<vec> cflt(nv);
-	for (int i = 0; i < nv; i++)
-		diffuse_vert_field(themesh, AccumCurv(), i, invsigma2, cflt[i]);
+	vector<vec> cflt;
+	diffuse_field(themesh, AccumCurv(), invsigma2, cflt);
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++)
 		diagonalize_curv(themesh->pdir1[i], themesh->pdir2[i],
@@ -322,6 +736,10 @@ void diffuse_curv(TriMesh *themesh, float sigma)
 				 themesh->pdir1[i], themesh->pdir2[i],
 				 themesh->curv1[i], themesh->curv2[i]);
 
+	// As above: filtered, so not what need_curvatures would give
+	themesh->cache_invalidate(TriMesh::CACHE_CURVATURES);
+	themesh->cache_invalidate(TriMesh::CACHE_DCURV);
+
 	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
@@ -329,25 +747,22 @@ void diffuse_curv(TriMesh *themesh, float sigma)
 // Diffuse the curvature derivatives across the mesh
 void diffuse_dcurv(TriMesh *themesh, float sigma)
 {
-	themesh->need_normals();
-	themesh->need_pointareas();
+	themesh->need_geometry(TriMesh::GEOM_NORMALS |
+			       TriMesh::GEOM_POINTAREAS);
 	themesh->need_curvatures();
 	themesh->need_dcurv();
 	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
-	if (themesh->flags.size() != nv)
-		themesh->flags.resize(nv);
 
 	TriMesh::dprintf("\rSmoothing curvature derivatives... ");
 	timestamp t = now();
 
 	float invsigma2 = 1.0f / sqr(sigma);
 
-	vector< Vec<4> > dflt(nv);
-	for (int i = 0; i < nv; i++)
-		diffuse_vert_field(themesh, AccumDCurv(), i, invsigma2, dflt[i]);
+	vector< Vec<4> > dflt;
+	diffuse_field(themesh, AccumDCurv(), invsigma2, dflt);
 
 	themesh->dcurv = dflt;
+	themesh->cache_invalidate(TriMesh::CACHE_DCURV);
 	TriMesh::dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
@@ -9,11 +9,19 @@ Optimally re-triangulate a mesh by doing edge flips
 #include <stdio.h>
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "timestamp.h"
 #include <utility>
 #include <queue>
+#include <atomic>
+#include <cstring>
 using std::pair;
 using std::make_pair;
 using std::priority_queue;
+using std::atomic;
+
+
+// Give up on parallel flipping after this many rounds
+#define MAX_FLIP_ROUNDS 1000
 
 typedef pair<int,int> TriMeshEdge; // (face, edge) pair
 typedef pair<float, TriMeshEdge> TriMeshEdgeWithBenefit;
@@ -125,6 +133,25 @@ static int edge_flip(TriMesh *mesh, int f1, int e)
 }
 
 
+// need_across_edge marks boundary edges with the face's own index, while
+// the code here uses -1.  Convert back and forth.
+static void mark_bdy(TriMesh *mesh, bool self_to_none)
+{
+	int nf = mesh->faces.size();
+	int from = -1, to = -1;
+#pragma omp parallel for firstprivate(from, to)
+	for (int i = 0; i < nf; i++) {
+		if (self_to_none)
+			from = i;
+		else
+			to = i;
+		for (int j = 0; j < 3; j++)
+			if (mesh->across_edge[i][j] == from)
+				mesh->across_edge[i][j] = to;
+	}
+}
+
+
 // Do as many edge flips as necessary...
 void edgeflip(TriMesh *mesh)
 {
@@ -132,6 +159,7 @@ void edgeflip(TriMesh *mesh)
 	mesh->tstrips.clear();
 	mesh->grid.clear();
 	mesh->need_across_edge();
+	mark_bdy(mesh, true);
 
 	TriMesh::dprintf("Flipping edges... ");
 
@@ -171,6 +199,149 @@ void edgeflip(TriMesh *mesh)
 		}
 	}
 
+	// across_edge was kept up to date along the way
+	mark_bdy(mesh, false);
+	mesh->faces_changed();
+	mesh->cache_stamp(TriMesh::CACHE_ACROSS_EDGE);
+
 	TriMesh::dprintf("Done.\n");
 }
 
+
+// Faces touched by flipping edge e of face f: the two faces on the edge,
+// and the faces across their other edges.  Returns how many there are.
+static int flip_faces(const TriMesh *mesh, int f, int e, int faces[6])
+{
+	int ae = mesh->across_edge[f][e];
+	int n = 0;
+	faces[n++] = f;
+	faces[n++] = ae;
+	for (int j = 0; j < 3; j++) {
+		int a = mesh->across_edge[f][j];
+		if (a >= 0 && a != ae)
+			faces[n++] = a;
+		a = mesh->across_edge[ae][j];
+		if (a >= 0 && a != f)
+			faces[n++] = a;
+	}
+	return n;
+}
+
+
+// Parallel version of the above.  In each round, every beneficial edge
+// bids for the faces its flip would touch, with the highest benefit
+// winning each face.  Edges that win all their faces are independent of
+// each other and are flipped at once.  Only edges of faces that changed
+// (or that lost a bid) are looked at again in the next round.  The order
+// of flips differs from the serial version, so the result is comparable
+// but not identical.
+void edgeflip_parallel(TriMesh *mesh)
+{
+	mesh->need_faces();
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+	mesh->need_across_edge();
+	mark_bdy(mesh, true);
+
+	TriMesh::dprintf("Flipping edges in parallel... ");
+	timestamp t = now();
+
+	int nf = mesh->faces.size();
+	vector<char> active(nf, 1), next_active(nf);
+	vector<float> benefit(3*nf);
+	vector<int> cands, cand_faces, cand_nfaces;
+	vector< atomic<unsigned long long> > claim(nf);
+	int round = 0, nflips = 0;
+
+	for (round = 0; round < MAX_FLIP_ROUNDS; round++) {
+		// Benefit of every edge near an active face, evaluated from
+		// one side only
+#pragma omp parallel for
+		for (int i = 0; i < nf; i++) {
+			for (int j = 0; j < 3; j++) {
+				float &b = benefit[3*i+j];
+				b = 0.0f;
+				if (!active[i])
+					continue;
+				int ae = mesh->across_edge[i][j];
+				if (ae < 0 || (active[ae] && ae < i))
+					continue;
+				b = flip_benefit(mesh, i, j);
+			}
+		}
+		cands.clear();
+		for (int i = 0; i < 3*nf; i++)
+			if (benefit[i] > 0.0f)
+				cands.push_back(i);
+		int nc = cands.size();
+		if (!nc)
+			break;
+		cand_faces.resize(6*nc);
+		cand_nfaces.resize(nc);
+
+		// Bid: benefit in the high bits (positive floats sort like
+		// their bit patterns), lowest edge index wins ties
+#pragma omp parallel for
+		for (int i = 0; i < nf; i++)
+			claim[i].store(0, std::memory_order_relaxed);
+#pragma omp parallel for
+		for (int c = 0; c < nc; c++) {
+			int ind = cands[c];
+			unsigned bits;
+			memcpy(&bits, &benefit[ind], sizeof(bits));
+			unsigned long long key =
+				((unsigned long long) bits << 32) | ~(unsigned) ind;
+			// Remembered for the flip phase, which can't look at
+			// across_edge while the winners are changing it
+			int *ff = &cand_faces[6*c];
+			int n = cand_nfaces[c] =
+				flip_faces(mesh, ind / 3, ind % 3, ff);
+			for (int k = 0; k < n; k++) {
+				unsigned long long old = claim[ff[k]].load();
+				while (old < key &&
+				       !claim[ff[k]].compare_exchange_weak(old, key))
+					;
+			}
+		}
+
+		// Flip the winners, and decide what to look at next time
+#pragma omp parallel for
+		for (int i = 0; i < nf; i++)
+			next_active[i] = 0;
+		int round_flips = 0;
+#pragma omp parallel for reduction(+:round_flips)
+		for (int c = 0; c < nc; c++) {
+			int ind = cands[c];
+			unsigned bits;
+			memcpy(&bits, &benefit[ind], sizeof(bits));
+			unsigned long long key =
+				((unsigned long long) bits << 32) | ~(unsigned) ind;
+			const int *ff = &cand_faces[6*c];
+			int n = cand_nfaces[c];
+			bool won = true;
+			for (int k = 0; k < n; k++)
+				if (claim[ff[k]].load() != key)
+					won = false;
+			if (won) {
+				edge_flip(mesh, ind / 3, ind % 3);
+				round_flips++;
+			}
+			// A flip only changes the benefit of the edges of
+			// the two faces involved, and the losers try again
+			for (int k = 0; k < 2; k++) {
+#pragma omp atomic write
+				next_active[ff[k]] = 1;
+			}
+		}
+		nflips += round_flips;
+		active.swap(next_active);
+	}
+
+	mark_bdy(mesh, false);
+	mesh->faces_changed();
+	mesh->cache_stamp(TriMesh::CACHE_ACROSS_EDGE);
+
+	TriMesh::dprintf("Done.  %d flips in %d rounds, %f sec.\n",
+			 nflips, round, now() - t);
+}
+
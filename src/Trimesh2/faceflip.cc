@@ -22,6 +22,7 @@ void faceflip(TriMesh *mesh)
 #pragma omp parallel for
 	for (int i = 0; i < nf; i++)
 		swap(mesh->faces[i][0], mesh->faces[i][2]);
+	mesh->faces_changed();
 	TriMesh::dprintf("Done.\n");
 
 	if (had_tstrips)
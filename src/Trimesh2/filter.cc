@@ -39,8 +39,7 @@ inline void inflate(TriMesh *mesh, float amount)
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] += amount * mesh->normals[i];
 	TriMesh::dprintf("Done.\n");
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+	mesh->vertices_changed();
 }
 
 
@@ -50,6 +49,7 @@ inline void apply_xform(TriMesh *mesh, const xform &xf)
 	int nv = mesh->vertices.size();
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] = xf * mesh->vertices[i];
+	mesh->vertices_changed();
 	if (!mesh->normals.empty()) {
 		xform nxf = norm_xf(xf);
 		for (int i = 0; i < nv; i++) {
@@ -447,6 +447,7 @@ inline void orient(TriMesh *mesh)
 		if (cc_flip[mesh->flags[i]])
 			swap(mesh->faces[i][1], mesh->faces[i][2]);
 	}
+	mesh->faces_changed();
 	TriMesh::dprintf("Done.\n");
 }
 
@@ -486,5 +487,6 @@ inline void noisify(TriMesh *mesh, float amount)
 	}
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] += disp[i];
+	mesh->vertices_changed();
 }
 
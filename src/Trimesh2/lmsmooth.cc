@@ -7,20 +7,36 @@ Taubin lambda/mu mesh smoothing
 */
 
 #include <stdio.h>
+#include <cmath>
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "timestamp.h"
 
 
-// One iteration of umbrella-operator smoothing
-void umbrella(TriMesh *mesh, float stepsize)
+#define IMPLICIT_MAX_ITERS 500
+#define IMPLICIT_TOL 1.0e-4
+
+
+// Which vertices are on the boundary
+static void find_bdy(TriMesh *mesh, vector<bool> &bdy)
 {
-	mesh->need_neighbors();
-	mesh->need_adjacentfaces();
 	int nv = mesh->vertices.size();
-	vector<vec> disp(nv);
+	bdy.resize(nv);
+	for (int i = 0; i < nv; i++)
+		bdy[i] = mesh->is_bdy(i);
+}
+
+
+// One umbrella step, given the boundary and a displacement buffer
+static void umbrella(TriMesh *mesh, float stepsize,
+		     const vector<bool> &bdy, vector<vec> &disp)
+{
+	int nv = mesh->vertices.size();
+	disp.resize(nv);
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++) {
-		if (mesh->is_bdy(i)) {
+		disp[i].clear();
+		if (bdy[i]) {
 			// Change to #if 1 to smooth boundaries.
 			// This way, we leave boundaries alone.
 #if 0
@@ -29,15 +45,13 @@ void umbrella(TriMesh *mesh, float stepsize)
 			if (!nn)
 				continue;
 			for (int j = 0; j < nn; j++) {
-				if (!mesh->is_bdy(mesh->neighbors[i][j]))
+				if (!bdy[mesh->neighbors[i][j]])
 					continue;
 				disp[i] += mesh->vertices[mesh->neighbors[i][j]];
 				nnused++;
 			}
 			disp[i] /= nnused;
 			disp[i] -= mesh->vertices[i];
-#else
-			disp[i].clear();
 #endif
 		} else {
 			int nn = mesh->neighbors[i].size();
@@ -52,9 +66,20 @@ void umbrella(TriMesh *mesh, float stepsize)
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] += stepsize * disp[i];
+}
+
+
+// One iteration of umbrella-operator smoothing
+void umbrella(TriMesh *mesh, float stepsize)
+{
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	vector<bool> bdy;
+	find_bdy(mesh, bdy);
+	vector<vec> disp;
+	umbrella(mesh, stepsize, bdy, disp);
 
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+	mesh->vertices_changed();
 }
 
 
@@ -64,13 +89,194 @@ void lmsmooth(TriMesh *mesh, int niters)
 	mesh->need_neighbors();
 	mesh->need_adjacentfaces();
 	TriMesh::dprintf("Smoothing mesh... ");
+	vector<bool> bdy;
+	find_bdy(mesh, bdy);
+	vector<vec> disp;
 	for (int i = 0; i < niters; i++) {
-		umbrella(mesh, 0.330f);
-		umbrella(mesh, -0.331f);
+		umbrella(mesh, 0.330f, bdy, disp);
+		umbrella(mesh, -0.331f, bdy, disp);
 	}
 	TriMesh::dprintf("Done.\n");
 
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+	mesh->vertices_changed();
 }
 
+
+// Apply the matrix of the implicit smoothing system, D + lambda L or
+// D + lambda L D^-1 L, where L = D - A is the graph Laplacian, to v.
+// Entries of v at fixed vertices must be zero on input, and out is only
+// meaningful at free vertices.
+static void implicit_apply(const vector<int> &start, const vector<int> &col,
+			   const vector<float> &deg, const vector<float> &invdeg,
+			   float lambda, bool bilaplacian,
+			   const vector<vec> &v, vector<vec> &tmp,
+			   vector<vec> &out)
+{
+	int nv = deg.size();
+	vector<vec> &lv = bilaplacian ? tmp : out;
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		vec l = deg[i] * v[i];
+		for (int j = start[i]; j < start[i+1]; j++)
+			l -= v[col[j]];
+		lv[i] = l;
+	}
+	if (!bilaplacian) {
+#pragma omp parallel for
+		for (int i = 0; i < nv; i++)
+			out[i] = deg[i] * v[i] + lambda * out[i];
+		return;
+	}
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		tmp[i] *= invdeg[i];
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		vec l = deg[i] * tmp[i];
+		for (int j = start[i]; j < start[i+1]; j++)
+			l -= tmp[col[j]];
+		out[i] = deg[i] * v[i] + lambda * l;
+	}
+}
+
+
+// Implicit umbrella smoothing: one backward-Euler step of size lambda,
+// i.e. solve (D + lambda L) x = D x0 for the new positions x, where L is
+// the graph Laplacian and D the valences.  With bilaplacian set, the
+// system is (D + lambda L D^-1 L) x = D x0 instead, which like Taubin
+// smoothing damps noise without shrinking the low frequencies much.
+// Boundary (and isolated) vertices stay fixed, which leaves a symmetric
+// positive definite system over the rest.  This is solved by conjugate
+// gradients with a Jacobi preconditioner, for all three coordinates at
+// once, over the adjacency in CSR form.
+void lmsmooth_implicit(TriMesh *mesh, float lambda, bool bilaplacian /* = true */)
+{
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	int nv = mesh->vertices.size();
+
+	TriMesh::dprintf("Smoothing mesh implicitly... ");
+	timestamp t = now();
+
+	vector<bool> bdy;
+	find_bdy(mesh, bdy);
+	vector<bool> fixed(nv);
+	vector<int> start(nv + 1), col;
+	vector<float> deg(nv), invdeg(nv);
+	for (int i = 0; i < nv; i++) {
+		const vector<int> &nbrs = mesh->neighbors[i];
+		fixed[i] = bdy[i] || nbrs.empty();
+		col.insert(col.end(), nbrs.begin(), nbrs.end());
+		start[i+1] = col.size();
+		deg[i] = nbrs.size();
+		invdeg[i] = nbrs.empty() ? 0.0f : 1.0f / deg[i];
+	}
+
+	// Jacobi preconditioner: the diagonal of the system
+	vector<float> invdiag(nv);
+	for (int i = 0; i < nv; i++) {
+		if (fixed[i])
+			continue;
+		float d = deg[i] + lambda * deg[i];
+		if (bilaplacian) {
+			for (int j = start[i]; j < start[i+1]; j++)
+				d += lambda * invdeg[col[j]];
+		}
+		invdiag[i] = 1.0f / d;
+	}
+
+	// Right-hand side D x0 - (system applied to the fixed positions)
+	vector<vec> x(nv), res(nv), z(nv), p(nv), q(nv), tmp(nv);
+	for (int i = 0; i < nv; i++)
+		if (fixed[i])
+			p[i] = mesh->vertices[i];
+	implicit_apply(start, col, deg, invdeg, lambda, bilaplacian, p, tmp, q);
+	vector<vec> b(nv);
+	for (int i = 0; i < nv; i++)
+		if (!fixed[i])
+			b[i] = deg[i] * mesh->vertices[i] - q[i];
+
+	// PCG, starting from the current positions
+	for (int i = 0; i < nv; i++)
+		if (!fixed[i])
+			x[i] = mesh->vertices[i];
+	implicit_apply(start, col, deg, invdeg, lambda, bilaplacian, x, tmp, q);
+	double rz[3] = { 0, 0, 0 }, bb[3] = { 0, 0, 0 };
+	for (int i = 0; i < nv; i++) {
+		if (fixed[i]) {
+			p[i].clear();
+			continue;
+		}
+		res[i] = b[i] - q[i];
+		z[i] = invdiag[i] * res[i];
+		p[i] = z[i];
+		for (int k = 0; k < 3; k++) {
+			rz[k] += res[i][k] * z[i][k];
+			bb[k] += sqr(b[i][k]);
+		}
+	}
+
+	int iter;
+	double tol2 = sqr(IMPLICIT_TOL);
+	for (iter = 0; iter < IMPLICIT_MAX_ITERS; iter++) {
+		implicit_apply(start, col, deg, invdeg, lambda, bilaplacian,
+			       p, tmp, q);
+		double pq0 = 0, pq1 = 0, pq2 = 0;
+#pragma omp parallel for reduction(+:pq0,pq1,pq2)
+		for (int i = 0; i < nv; i++) {
+			if (fixed[i])
+				continue;
+			pq0 += p[i][0] * q[i][0];
+			pq1 += p[i][1] * q[i][1];
+			pq2 += p[i][2] * q[i][2];
+		}
+		double pq[3] = { pq0, pq1, pq2 };
+		vec alpha;
+		for (int k = 0; k < 3; k++)
+			alpha[k] = (pq[k] > 0.0) ? float(rz[k] / pq[k]) : 0.0f;
+
+		double rz0 = 0, rz1 = 0, rz2 = 0, rr0 = 0, rr1 = 0, rr2 = 0;
+#pragma omp parallel for reduction(+:rz0,rz1,rz2,rr0,rr1,rr2)
+		for (int i = 0; i < nv; i++) {
+			if (fixed[i])
+				continue;
+			for (int k = 0; k < 3; k++) {
+				x[i][k] += alpha[k] * p[i][k];
+				res[i][k] -= alpha[k] * q[i][k];
+			}
+			z[i] = invdiag[i] * res[i];
+			rz0 += res[i][0] * z[i][0];
+			rz1 += res[i][1] * z[i][1];
+			rz2 += res[i][2] * z[i][2];
+			rr0 += sqr(res[i][0]);
+			rr1 += sqr(res[i][1]);
+			rr2 += sqr(res[i][2]);
+		}
+		if (rr0 <= tol2 * bb[0] && rr1 <= tol2 * bb[1] &&
+		    rr2 <= tol2 * bb[2])
+			break;
+
+		double rznew[3] = { rz0, rz1, rz2 };
+		vec beta;
+		for (int k = 0; k < 3; k++) {
+			beta[k] = (rz[k] > 0.0) ? float(rznew[k] / rz[k]) : 0.0f;
+			rz[k] = rznew[k];
+		}
+#pragma omp parallel for
+		for (int i = 0; i < nv; i++) {
+			if (fixed[i])
+				continue;
+			for (int k = 0; k < 3; k++)
+				p[i][k] = z[i][k] + beta[k] * p[i][k];
+		}
+	}
+
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		if (!fixed[i])
+			mesh->vertices[i] = x[i];
+
+	TriMesh::dprintf("Done.  %d CG iterations, %f sec.\n", iter, now() - t);
+
+	mesh->vertices_changed();
+}
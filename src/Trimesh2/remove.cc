@@ -94,6 +94,7 @@ void remove_faces(TriMesh *mesh, const vector<bool> &toremove)
 	}
 
 	mesh->faces.erase(mesh->faces.begin() + next, mesh->faces.end());
+	mesh->faces_changed();
 	TriMesh::dprintf("%d faces removed... Done.\n", numfaces - next);
 
 	if (had_tstrips)
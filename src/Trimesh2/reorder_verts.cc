@@ -9,7 +9,14 @@ Reorder and remap vertices.
 #include <stdio.h>
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "timestamp.h"
 #include <vector>
+#include <algorithm>
+using namespace std;
+
+
+// Bits per axis in the Morton codes used by reorder_spatial
+#define MORTON_BITS 21
 
 
 // Remap vertices according to the given table
@@ -98,6 +105,8 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 			nextface++;
 	}
 	mesh->faces.erase(mesh->faces.begin() + nextface, mesh->faces.end());
+	mesh->vertices_changed();
+	mesh->faces_changed();
 
 	// Renumber grid
 	if (have_grid) {
@@ -208,3 +217,111 @@ void reorder_verts(TriMesh *mesh)
 	TriMesh::dprintf("Done.\n");
 }
 
+
+// Spread the low MORTON_BITS bits of x out to every third bit
+static inline unsigned long long morton_spread(unsigned long long x)
+{
+	x &= 0x1fffffULL;
+	x = (x | (x << 32)) & 0x001f00000000ffffULL;
+	x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+	x = (x | (x <<  8)) & 0x100f00f00f00f00fULL;
+	x = (x | (x <<  4)) & 0x10c30c30c30c30c3ULL;
+	x = (x | (x <<  2)) & 0x1249249249249249ULL;
+	return x;
+}
+
+
+// Position of p along a Z-order curve through the bounding box
+static inline unsigned long long morton_code(const point &p,
+	const TriMesh::BBox &bbox, const vec &scale)
+{
+	unsigned long long code = 0;
+	for (int j = 0; j < 3; j++) {
+		float x = (p[j] - bbox.min[j]) * scale[j];
+		unsigned long long q = (x > 0.0f) ?
+			(unsigned long long) x : 0ULL;
+		q = min(q, (unsigned long long) ((1 << MORTON_BITS) - 1));
+		code |= morton_spread(q) << j;
+	}
+	return code;
+}
+
+
+// Reorder faces along a Z-order (Morton) curve through the bounding box,
+// then vertices in the order the faces first use them, so that neighbors
+// on the surface are also neighbors in memory.  Faces stay within their
+// usemtl groups, and carry their texture coordinates and labels along.
+// Unreferenced vertices go at the end, in curve order.
+void reorder_spatial(TriMesh *mesh)
+{
+	mesh->need_bbox();
+	if (!mesh->bbox.valid)
+		return;
+
+	TriMesh::dprintf("Reordering mesh along Morton curve... ");
+	timestamp t = now();
+
+	const TriMesh::BBox &bbox = mesh->bbox;
+	vec size = bbox.max - bbox.min;
+	vec scale;
+	for (int j = 0; j < 3; j++)
+		scale[j] = (size[j] > 0.0f) ?
+			float(1 << MORTON_BITS) / size[j] : 0.0f;
+
+	// Sort faces by (material group, Morton code of centroid).  The
+	// index breaks ties, so the sort is deterministic.
+	int nf = mesh->faces.size();
+	if (nf) {
+		vector<int> group(nf);
+		int ng = mesh->usemtl_indices.size();
+		for (int i = 0, g = 0; i < nf; i++) {
+			while (g < ng && mesh->usemtl_indices[g] <= i)
+				g++;
+			group[i] = g;
+		}
+
+		typedef pair<unsigned long long, int> Key;
+		vector< pair<int, Key> > keys(nf);
+#pragma omp parallel for
+		for (int i = 0; i < nf; i++) {
+			const Face &f = mesh->faces[i];
+			point c = (1.0f / 3.0f) * (mesh->vertices[f[0]] +
+				mesh->vertices[f[1]] + mesh->vertices[f[2]]);
+			keys[i] = make_pair(group[i],
+				Key(morton_code(c, bbox, scale), i));
+		}
+		sort(keys.begin(), keys.end());
+
+		vector<Face> newfaces(nf);
+		for (int i = 0; i < nf; i++)
+			newfaces[i] = mesh->faces[keys[i].second.second];
+		mesh->faces.swap(newfaces);
+	}
+
+	// Vertices in order of first use by the (now sorted) faces
+	int nv = mesh->vertices.size();
+	vector<int> remap(nv, -1);
+	int next = 0;
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			int v = mesh->faces[i][j];
+			if (remap[v] == -1)
+				remap[v] = next++;
+		}
+	}
+	if (next != nv) {
+		vector< pair<unsigned long long, int> > loose;
+		for (int i = 0; i < nv; i++)
+			if (remap[i] == -1)
+				loose.push_back(make_pair(
+					morton_code(mesh->vertices[i], bbox, scale), i));
+		sort(loose.begin(), loose.end());
+		for (size_t i = 0; i < loose.size(); i++)
+			remap[loose[i].second] = next++;
+	}
+
+	// This also recomputes the face-indexed connectivity, if present
+	remap_verts(mesh, remap);
+
+	TriMesh::dprintf("Done.  %.2f msec.\n", (now() - t) * 1000.0f);
+}
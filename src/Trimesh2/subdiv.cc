@@ -10,6 +10,9 @@ Perform subdivision on a mesh.
 #include <stdio.h>
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include "timestamp.h"
+#include <algorithm>
+using namespace std;
 
 
 // i+1 and i-1 modulo 3
@@ -33,7 +36,7 @@ static point opposite(TriMesh *mesh, int f, int v)
 {
 	int ind = mesh->faces[f].indexof(v);
 	int ae = mesh->across_edge[f][ind];
-	if (ae) {
+	if (ae != -1) {
 		int j = mesh->faces[ae].indexof(mesh->faces[f][NEXT(ind)]);
 		return mesh->vertices[mesh->faces[ae][NEXT(j)]];
 	}
@@ -198,16 +201,12 @@ static float loop_update_alpha(int scheme, int n)
 }
 
 
-// Insert a new vertex
-static void insert_vert(TriMesh *mesh, int scheme, int f, int e)
+// Position of the new vertex on edge e of face f
+static point edge_vert(TriMesh *mesh, int scheme, int f, int e)
 {
 	int v1 = mesh->faces[f][NEXT(e)], v2 = mesh->faces[f][PREV(e)];
-	if (scheme == SUBDIV_PLANAR) {
-		point p = 0.5f * (mesh->vertices[v1] +
-				  mesh->vertices[v2]);
-		mesh->vertices.push_back(p);
-		return;
-	}
+	if (scheme == SUBDIV_PLANAR)
+		return 0.5f * (mesh->vertices[v1] + mesh->vertices[v2]);
 
 	int ae = mesh->across_edge[f][e];
 	if (ae == -1) {
@@ -219,8 +218,7 @@ static void insert_vert(TriMesh *mesh, int scheme, int f, int e)
 			p *= 1.5f;
 			p -= 0.25f * (avg_bdy(mesh, v1) + avg_bdy(mesh, v2));
 		}
-		mesh->vertices.push_back(p);
-		return;
+		return p;
 	}
 
 	int v0 = mesh->faces[f][e];
@@ -256,12 +254,78 @@ static void insert_vert(TriMesh *mesh, int scheme, int f, int e)
 		else
 			p = butterfly(mesh, f, ae, v0, v1, v2, v3);
 	}
+	return p;
+}
+
+
+// New position of original vertex i under the Loop schemes
+static point loop_vert(TriMesh *mesh, int scheme, int i)
+{
+	const point &v = mesh->vertices[i];
+	point bdyavg, nbdyavg;
+	int nbdy = 0, nnbdy = 0;
+	int naf = mesh->adjacentfaces[i].size();
+	for (int j = 0; j < naf; j++) {
+		int af = mesh->adjacentfaces[i][j];
+		int afi = mesh->faces[af].indexof(i);
+		int n1 = NEXT(afi);
+		int n2 = PREV(afi);
+		if (mesh->across_edge[af][n1] == -1) {
+			bdyavg += mesh->vertices[mesh->faces[af][n2]];
+			nbdy++;
+		} else {
+			nbdyavg += mesh->vertices[mesh->faces[af][n2]];
+			nnbdy++;
+		}
+		if (mesh->across_edge[af][n2] == -1) {
+			bdyavg += mesh->vertices[mesh->faces[af][n1]];
+			nbdy++;
+		} else {
+			nbdyavg += mesh->vertices[mesh->faces[af][n1]];
+			nnbdy++;
+		}
+	}
+
+	float alpha;
+	point newpt;
+	if (nbdy) {
+		newpt = bdyavg / (float) nbdy;
+		alpha = 0.75f;
+	} else if (nnbdy) {
+		newpt = nbdyavg / (float) nnbdy;
+		alpha = loop_update_alpha(scheme, nnbdy/2);
+	} else {
+		return v;
+	}
+	point p = v;
+	p *= alpha;
+	p += (1.0f - alpha) * newpt;
+	return p;
+}
 
-	mesh->vertices.push_back(p);
+
+// Which slot of face ae holds the edge it shares with face f
+static inline int across_slot(const TriMesh *mesh, int ae, int f)
+{
+	const Face &a = mesh->across_edge[ae];
+	return (a[0] == f) ? 0 : (a[1] == f) ? 1 : (a[2] == f) ? 2 : -1;
 }
 
 
-// Subdivide a mesh
+// Does face f create the new vertex on its edge e?  Shared edges belong
+// to the lower-numbered face.
+static inline bool owns_edge(const TriMesh *mesh, int f, int e)
+{
+	int ae = mesh->across_edge[f][e];
+	return ae == -1 || ae > f || across_slot(mesh, ae, f) < 0;
+}
+
+
+// Subdivide a mesh.
+// Counting the edges each face owns and taking a prefix sum numbers the
+// new vertices (in the same order as a serial walk over the faces would).  After that,
+// new vertices, updated old vertices, and new faces are all independent
+// and computed in parallel.
 void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
 {
 	bool have_col = !mesh->colors.empty();
@@ -278,56 +342,76 @@ void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
 	mesh->neighbors.clear();
 	mesh->need_across_edge(); mesh->need_adjacentfaces();
 
-
 	TriMesh::dprintf("Subdividing mesh... ");
+	timestamp t = now();
 
-	// Introduce new vertices
 	int nf = mesh->faces.size();
-	vector<Face> newverts(nf, Face(-1,-1,-1));
 	int old_nv = mesh->vertices.size();
-	mesh->vertices.reserve(4 * old_nv);
-	vector<int> newvert_count(old_nv + 3*nf);
-	if (have_col)
-		mesh->colors.reserve(4 * old_nv);
-	if (have_conf)
-		mesh->confidences.reserve(4 * old_nv);
 
+	// need_across_edge marks boundary edges with the face's own index;
+	// the stencils below expect -1.  across_edge is thrown away at the
+	// end anyway.
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++)
+		for (int j = 0; j < 3; j++)
+			if (mesh->across_edge[i][j] == i)
+				mesh->across_edge[i][j] = -1;
+
+	// Number the edges
+	vector<int> first_edge(nf + 1);
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		int n = 0;
+		for (int j = 0; j < 3; j++)
+			if (owns_edge(mesh, i, j))
+				n++;
+		first_edge[i+1] = n;
+	}
+	for (int i = 0; i < nf; i++)
+		first_edge[i+1] += first_edge[i];
+	int ne = first_edge[nf];
+
+	vector<Face> newverts(nf, Face(-1,-1,-1));
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		int next = old_nv + first_edge[i];
+		for (int j = 0; j < 3; j++)
+			if (owns_edge(mesh, i, j))
+				newverts[i][j] = next++;
+	}
+#pragma omp parallel for
 	for (int i = 0; i < nf; i++) {
 		for (int j = 0; j < 3; j++) {
-			if (newverts[i][j] != -1)
+			if (owns_edge(mesh, i, j))
 				continue;
 			int ae = mesh->across_edge[i][j];
-			if (ae != -1) {
-				if (mesh->across_edge[ae][0] == i)
-					newverts[i][j] = newverts[ae][0];
-				else if (mesh->across_edge[ae][1] == i)
-					newverts[i][j] = newverts[ae][1];
-				else if (mesh->across_edge[ae][2] == i)
-					newverts[i][j] = newverts[ae][2];
-			}
-			if (newverts[i][j] != -1)
-				continue;
+			newverts[i][j] = newverts[ae][across_slot(mesh, ae, i)];
+		}
+	}
 
-			insert_vert(mesh, scheme, i, j);
-			newverts[i][j] = mesh->vertices.size() - 1;
-			if (ae != -1) {
-				if (mesh->across_edge[ae][0] == i)
-					newverts[ae][0] = newverts[i][j];
-				else if (mesh->across_edge[ae][1] == i)
-					newverts[ae][1] = newverts[i][j];
-				else if (mesh->across_edge[ae][2] == i)
-					newverts[ae][2] = newverts[i][j];
-			}
-			const Face &v = mesh->faces[i];
-			if (have_col) {
-				mesh->colors.push_back(0.5f *
-					mesh->colors[v[NEXT(j)]] +
-					mesh->colors[v[PREV(j)]]);
-			}
+	// Introduce new vertices.  Their positions only depend on the
+	// old vertices, which don't move until everything is done.
+	mesh->vertices.resize(old_nv + ne);
+	if (have_col)
+		mesh->colors.resize(old_nv + ne);
+	if (have_conf)
+		mesh->confidences.resize(old_nv + ne);
+#pragma omp parallel for
+	for (int i = 0; i < nf; i++) {
+		const Face &v = mesh->faces[i];
+		for (int j = 0; j < 3; j++) {
+			if (!owns_edge(mesh, i, j))
+				continue;
+			int nv = newverts[i][j];
+			mesh->vertices[nv] = edge_vert(mesh, scheme, i, j);
+			if (have_col)
+				mesh->colors[nv] = 0.5f *
+					(mesh->colors[v[NEXT(j)]] +
+					 mesh->colors[v[PREV(j)]]);
 			if (have_conf)
-				mesh->confidences.push_back(0.5f *
-					mesh->confidences[v[NEXT(j)]] +
-					mesh->confidences[v[PREV(j)]]);
+				mesh->confidences[nv] = 0.5f *
+					(mesh->confidences[v[NEXT(j)]] +
+					 mesh->confidences[v[PREV(j)]]);
 		}
 	}
 
@@ -335,62 +419,28 @@ void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
 	if (scheme == SUBDIV_LOOP ||
 	    scheme == SUBDIV_LOOP_ORIG ||
 	    scheme == SUBDIV_LOOP_NEW) {
+		vector<point> newpos(old_nv);
 #pragma omp parallel for
-		for (int i = 0; i < old_nv; i++) {
-			point bdyavg, nbdyavg;
-			int nbdy = 0, nnbdy = 0;
-			int naf = mesh->adjacentfaces[i].size();
-			if (!naf)
-				continue;
-			for (int j = 0; j < naf; j++) {
-				int af = mesh->adjacentfaces[i][j];
-				int afi = mesh->faces[af].indexof(i);
-				int n1 = NEXT(afi);
-				int n2 = PREV(afi);
-				if (mesh->across_edge[af][n1] == -1) {
-					bdyavg += mesh->vertices[mesh->faces[af][n2]];
-					nbdy++;
-				} else {
-					nbdyavg += mesh->vertices[mesh->faces[af][n2]];
-					nnbdy++;
-				}
-				if (mesh->across_edge[af][n2] == -1) {
-					bdyavg += mesh->vertices[mesh->faces[af][n1]];
-					nbdy++;
-				} else {
-					nbdyavg += mesh->vertices[mesh->faces[af][n1]];
-					nnbdy++;
-				}
-			}
-
-			float alpha;
-			point newpt;
-			if (nbdy) {
-				newpt = bdyavg / (float) nbdy;
-				alpha = 0.75f;
-			} else if (nnbdy) {
-				newpt = nbdyavg / (float) nnbdy;
-				alpha = loop_update_alpha(scheme, nnbdy/2);
-			} else {
-				continue;
-			}
-			mesh->vertices[i] *= alpha;
-			mesh->vertices[i] += (1.0f - alpha) * newpt;
-		}
+		for (int i = 0; i < old_nv; i++)
+			newpos[i] = loop_vert(mesh, scheme, i);
+		copy(newpos.begin(), newpos.end(), mesh->vertices.begin());
 	}
 
-	// Insert new faces
+	// Insert new faces: the three corner triangles of face i go at
+	// nf + 3*i, and the middle one replaces face i
 	mesh->adjacentfaces.clear(); mesh->across_edge.clear();
-	mesh->faces.reserve(4*nf);
+	mesh->faces.resize(4*nf);
+#pragma omp parallel for
 	for (int i = 0; i < nf; i++) {
 		Face &v = mesh->faces[i];
-		Face &n = newverts[i];
-		mesh->faces.push_back(Face(v[0], n[2], n[1]));
-		mesh->faces.push_back(Face(v[1], n[0], n[2]));
-		mesh->faces.push_back(Face(v[2], n[1], n[0]));
+		const Face &n = newverts[i];
+		mesh->faces[nf+3*i  ] = Face(v[0], n[2], n[1]);
+		mesh->faces[nf+3*i+1] = Face(v[1], n[0], n[2]);
+		mesh->faces[nf+3*i+2] = Face(v[2], n[1], n[0]);
 		v = n;
 	}
+	mesh->vertices_changed();
+	mesh->faces_changed();
 
-	TriMesh::dprintf("Done.\n");
+	TriMesh::dprintf("Done.  %d new vertices, %f sec.\n", ne, now() - t);
 }
-
@@ -0,0 +1,287 @@
+/*
+ * GarmentBench.cpp
+ *
+ * Times each stage of the pipeline, and the Trimesh2 kernels it leans
+ * on, on a generated shirt.  Every stage runs reps times on fresh input;
+ * the minimum is the number to compare run over run.  The kernels also
+ * run on a shuffled copy of the shirt, and on that copy after
+ * reorder_spatial, to show what vertex and face order is worth.
+ *
+ * Usage: garmentbench [around rows reps workdir report]
+ */
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <CGAL/IO/Polyhedron_iostream.h>
+
+#include "Trimesh2/TriMesh.h"
+#include "Trimesh2/TriMesh_algo.h"
+#include "Trimesh2/KDtree.h"
+#include "Trimesh2/ICP.h"
+#include "Trimesh2/XForm.h"
+
+#include <Borders.h>
+#include <Instrumentation.h>
+#include <bench/GarmentGenerator.h>
+
+typedef Instrumentation::ScopedTimer ScopedTimer;
+
+struct isequal {
+  isequal(int x) : x(x) {}
+  bool operator()(Face f) const {
+    return f.label == x;
+  }
+private:
+  int x;
+};
+
+// The pipeline, stage by stage, as CleanInterreflectionsAppMain runs it.
+// The cutoff is the armhole centroid height, rather than the slope search,
+// so that the amount trimmed is the same every run.
+static void runPipeline(const string& off, const string& obj, const string& out)
+{
+  Instrumentation& instrumentation = Instrumentation::get();
+
+  ScopedTimer parse_off_timer("parse_off");
+  std::ifstream stream(off.c_str());
+  Polyhedron mesh;
+  stream >> mesh;
+  int i(0);
+  for(Polyhedron::Facet_iterator it = mesh.facets_begin(); it != mesh.facets_end(); ++it)
+  {
+    it->id() = i++;
+  }
+  parse_off_timer.stop();
+
+  ScopedTimer parse_obj_timer("parse_obj");
+  TriMesh* trimesh = TriMesh::read(obj.c_str());
+  trimesh->need_faces();
+  trimesh->need_face_indices();
+  parse_obj_timer.stop();
+
+  ScopedTimer borders_timer("borders");
+  Borders borders(mesh);
+  borders.calcBorderCentroids();
+  borders.sortBorders();
+  reverse(borders.borders_.begin(), borders.borders_.end());
+  borders_timer.stop();
+
+  ScopedTimer smooth_timer("smooth_borders");
+  borders.smoothBorders(10);
+  smooth_timer.stop();
+
+  if (borders.borders_.size() < 4)
+  {
+    std::cout << "Expected at least 4 borders, found " << borders.borders_.size() << endl;
+    exit(1);
+  }
+
+  ScopedTimer trim_timer("delete_faces_below_y");
+  Borders::border left_arm_border = borders.borders_[0];
+  Borders::border right_arm_border = borders.borders_[0];
+  for (int i = 0; i < 4; i++)
+  {
+    auto& border = borders.borders_[i];
+    if (border.centroid.x() > left_arm_border.centroid.x())
+    {
+      left_arm_border = border;
+    }
+    if (border.centroid.x() < right_arm_border.centroid.x())
+    {
+      right_arm_border = border;
+    }
+  }
+  float cutoff_left = left_arm_border.centroid.y();
+  float cutoff_right = right_arm_border.centroid.y();
+  auto to_delete_left = borders.deleteFacesBelowY(left_arm_border, mesh, cutoff_left);
+  auto to_delete_right = borders.deleteFacesBelowY(right_arm_border, mesh, cutoff_right);
+  trim_timer.stop();
+
+  ScopedTimer compact_timer("compact");
+  for (auto i : to_delete_left)
+  {
+    trimesh->faces[i].label = 1;
+  }
+  for (auto i : to_delete_right)
+  {
+    trimesh->faces[i].label = 1;
+  }
+  vector<Face>::iterator it = std::remove_if(trimesh->faces.begin(), trimesh->faces.end(), isequal(1));
+  trimesh->faces.erase(it, trimesh->faces.end());
+  trimesh->faces_changed();
+  compact_timer.stop();
+
+  ScopedTimer write_timer("write_obj");
+  trimesh->write(out.c_str());
+  write_timer.stop();
+
+  instrumentation.set("out_faces", trimesh->faces.size());
+  delete trimesh;
+}
+
+// The Trimesh2 kernels, each from scratch.  Stage names start with
+// prefix, to tell the layouts apart.
+static void runKernels(TriMesh* shirt, const string& prefix = "")
+{
+  shirt->vertices_changed();
+  {
+    ScopedTimer timer((prefix + "need_normals").c_str());
+    shirt->need_normals();
+  }
+  {
+    ScopedTimer timer((prefix + "need_curvatures").c_str());
+    shirt->need_curvatures();
+  }
+
+  int nv = shirt->vertices.size();
+  KDtree* kd;
+  {
+    ScopedTimer timer((prefix + "kdtree_build").c_str());
+    kd = new KDtree(shirt->vertices);
+  }
+  {
+    ScopedTimer timer((prefix + "kdtree_query").c_str());
+    vec offset(0.001f, 0.0f, 0.0f);
+    for (int i = 0; i < nv; i++)
+    {
+      point p = shirt->vertices[i] + offset;
+      kd->closest_to_pt(p, 0.0001f);
+    }
+  }
+  delete kd;
+
+  // Align a copy of the shirt that's been nudged out of place
+  TriMesh moved;
+  moved.vertices = shirt->vertices;
+  moved.faces = shirt->faces;
+  xform xf1, xf2 = xform::trans(0.005f, 0.0f, -0.003f) *
+      xform::rot(0.02f, 0.0f, 1.0f, 0.0f);
+  {
+    ScopedTimer timer((prefix + "icp").c_str());
+    ICP(shirt, &moved, xf1, xf2, 0);
+  }
+}
+
+// A copy of the shirt with its vertices and faces in random order, as
+// a scanner might hand them over.  Always the same order.
+static TriMesh* shuffledCopy(const TriMesh* shirt)
+{
+  TriMesh* shuffled = new TriMesh;
+  shuffled->vertices = shirt->vertices;
+  shuffled->faces = shirt->faces;
+
+  std::mt19937 random(1);
+  int nv = shuffled->vertices.size();
+  vector<int> remap(nv);
+  for (int i = 0; i < nv; i++)
+  {
+    remap[i] = i;
+  }
+  for (int i = nv - 1; i > 0; i--)
+  {
+    swap(remap[i], remap[random() % (i + 1)]);
+  }
+  remap_verts(shuffled, remap);
+  for (int i = shuffled->faces.size() - 1; i > 0; i--)
+  {
+    swap(shuffled->faces[i], shuffled->faces[random() % (i + 1)]);
+  }
+  shuffled->faces_changed();
+  return shuffled;
+}
+
+static double median(vector<double> v)
+{
+  sort(v.begin(), v.end());
+  int n = v.size();
+  return (n % 2) ? v[n/2] : 0.5 * (v[n/2 - 1] + v[n/2]);
+}
+
+int main(int argc, char* argv[])
+{
+  GarmentParams params;
+  if (argc > 1) params.around = atoi(argv[1]);
+  if (argc > 2) params.rows = atoi(argv[2]);
+  int reps = (argc > 3) ? max(atoi(argv[3]), 1) : 3;
+  string workdir = (argc > 4) ? argv[4] : ".";
+  char const* filenameReport(argc > 5 ? argv[5] : NULL); // .json or .csv
+
+  TriMesh::set_verbose(0);
+  Instrumentation& instrumentation = Instrumentation::get();
+  char name[64];
+  sprintf(name, "shirt_%dx%d", params.around, params.rows);
+  instrumentation.garment_ = name;
+#ifdef _OPENMP
+  instrumentation.set("threads", omp_get_max_threads());
+#endif
+
+  string off = workdir + "/" + name + ".off";
+  string obj = workdir + "/" + name + ".obj";
+  string out = workdir + "/" + name + "_out.obj";
+
+  TriMesh* shirt;
+  {
+    ScopedTimer timer("generate");
+    shirt = makeShirt(params);
+  }
+  {
+    ScopedTimer timer("write_inputs");
+    writeShirt(shirt, off.c_str(), obj.c_str());
+  }
+  instrumentation.set("faces", shirt->faces.size());
+  instrumentation.set("vertices", shirt->vertices.size());
+
+  TriMesh* shuffled = shuffledCopy(shirt);
+  TriMesh* reordered = shuffledCopy(shirt);
+  {
+    ScopedTimer timer("reorder_spatial");
+    reorder_spatial(reordered);
+  }
+
+  for (int rep = 0; rep < reps; rep++)
+  {
+    runPipeline(off, obj, out);
+    runKernels(shirt);
+    runKernels(shuffled, "shuffled/");
+    runKernels(reordered, "spatial/");
+  }
+  delete shuffled;
+  delete reordered;
+
+  // Summarize the repeated stages in the order they first ran
+  vector<string> order;
+  map<string, vector<double> > times;
+  for (auto& s : instrumentation.stages_)
+  {
+    if (!times.count(s.name))
+    {
+      order.push_back(s.name);
+    }
+    times[s.name].push_back(s.seconds);
+  }
+  printf("%s: %d faces, %d reps\n", name, (int) shirt->faces.size(), reps);
+  printf("%-22s %10s %10s\n", "stage", "min ms", "median ms");
+  for (auto& stage : order)
+  {
+    const vector<double>& t = times[stage];
+    printf("%-22s %10.1f %10.1f\n", stage.c_str(),
+        1000.0 * *min_element(t.begin(), t.end()), 1000.0 * median(t));
+  }
+  printf("peak RSS %ld KB\n", Instrumentation::peakRSSKb());
+
+  if (filenameReport)
+  {
+    instrumentation.writeReport(filenameReport);
+  }
+  delete shirt;
+}
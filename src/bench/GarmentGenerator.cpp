@@ -0,0 +1,110 @@
+/*
+ * GarmentGenerator.cpp
+ *
+ * Procedural shirt-like meshes for benchmarking.
+ */
+
+#include <bench/GarmentGenerator.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "Trimesh2/TriMesh_algo.h"
+
+// Torso half-widths and height, in meters
+#define SHIRT_RADIUS_X 0.25f
+#define SHIRT_RADIUS_Z 0.15f
+#define SHIRT_HEIGHT 0.7f
+
+// Armhole center height and half-size, as fractions of the grid
+#define ARMHOLE_Y 0.8f
+#define ARMHOLE_HALF_AROUND 0.06f
+#define ARMHOLE_HALF_ROWS 0.1f
+
+// Small portable generator, so meshes match across platforms
+static inline float nextRandom(unsigned& state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state & 0xffffff) / float(0x1000000);
+}
+
+// Whether grid cell (i,j) falls in the armhole centered at column ci
+static bool inArmhole(int i, int j, int ci, const GarmentParams& params)
+{
+  float di = fabsf(i + 0.5f - ci);
+  di = fminf(di, params.around - di); // Wrap around the tube
+  di /= ARMHOLE_HALF_AROUND * params.around;
+  float dj = (j + 0.5f - ARMHOLE_Y * (params.rows - 1)) /
+      (ARMHOLE_HALF_ROWS * params.rows);
+  return di * di + dj * dj < 1.0f;
+}
+
+TriMesh* makeShirt(const GarmentParams& params)
+{
+  int nx = params.around, ny = params.rows;
+  unsigned state = params.seed ? params.seed : 1;
+
+  TriMesh* shirt = new TriMesh;
+  shirt->vertices.reserve(nx * ny);
+  for (int j = 0; j < ny; j++)
+  {
+    float t = float(j) / (ny - 1);
+    float y = t * SHIRT_HEIGHT;
+    // Narrower at the waist, sloping in toward the shoulders
+    float scale = 1.0f - 0.08f * sinf(float(M_PI) * t) - 0.15f * t * t * t;
+    for (int i = 0; i < nx; i++)
+    {
+      float theta = 2.0f * float(M_PI) * i / nx;
+      float r = scale * (1.0f + 0.02f * sinf(5.0f * theta + 7.0f * t) +
+          params.noise * (nextRandom(state) - 0.5f));
+      shirt->vertices.push_back(point(r * SHIRT_RADIUS_X * cosf(theta), y,
+          r * SHIRT_RADIUS_Z * sinf(theta)));
+    }
+  }
+
+  // Texture coordinates: the seam column appears twice
+  for (int j = 0; j < ny; j++)
+  {
+    for (int i = 0; i <= nx; i++)
+    {
+      vector<float> vt(2);
+      vt[0] = float(i) / nx;
+      vt[1] = float(j) / (ny - 1);
+      shirt->vts.push_back(vt);
+    }
+  }
+  strcpy(shirt->mtllib, "shirt.mtl");
+  shirt->usemtl.push_back("shirt");
+  shirt->usemtl_indices.push_back(0);
+
+  // Two triangles per grid cell, leaving out the armholes at the sides
+  // of the tube (theta = 0 and pi)
+  shirt->faces.reserve(2 * nx * (ny - 1));
+  for (int j = 0; j < ny - 1; j++)
+  {
+    for (int i = 0; i < nx; i++)
+    {
+      if (inArmhole(i, j, 0, params) || inArmhole(i, j, nx / 2, params))
+      {
+        continue;
+      }
+      int a = j * nx + i, b = j * nx + (i + 1) % nx;
+      int c = a + nx, d = b + nx;
+      int ta = j * (nx + 1) + i, tb = ta + 1;
+      int tc = ta + nx + 1, td = tb + nx + 1;
+      shirt->faces.push_back(Face(a, d, b, ta, td, tb));
+      shirt->faces.push_back(Face(a, c, d, ta, tc, td));
+    }
+  }
+  shirt->faces_changed();
+  remove_unused_vertices(shirt);
+  return shirt;
+}
+
+void writeShirt(TriMesh* shirt, const char* filenameOff, const char* filenameObj)
+{
+  shirt->write(filenameOff);
+  shirt->write(filenameObj);
+}
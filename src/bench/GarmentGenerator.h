@@ -0,0 +1,32 @@
+/*
+ * GarmentGenerator.h
+ *
+ * Procedural shirt-like meshes for benchmarking: a noisy torso tube,
+ * open at the hem and neck, with an armhole cut into each side.  That
+ * gives the four borders the pipeline expects, with the armholes
+ * furthest left and right.
+ */
+
+#ifndef GARMENT_GENERATOR_
+#define GARMENT_GENERATOR_
+
+#include "Trimesh2/TriMesh.h"
+
+struct GarmentParams {
+  int around;      // Vertices around the torso
+  int rows;        // Vertices from hem to neck
+  float noise;     // Radial noise, as a fraction of the radius
+  unsigned seed;
+
+  GarmentParams() : around(1000), rows(1000), noise(0.01f), seed(1) {}
+};
+
+// About 2 * around * rows faces, with texture coordinates.  The same
+// parameters always give the same mesh, on any platform.
+TriMesh* makeShirt(const GarmentParams& params);
+
+// Write the mesh as both OFF (for CGAL) and OBJ (for TriMesh), with the
+// faces in the same order, as the pipeline expects
+void writeShirt(TriMesh* shirt, const char* filenameOff, const char* filenameObj);
+
+#endif /* GARMENT_GENERATOR_ */